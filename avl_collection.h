@@ -1,4 +1,3 @@
-
 //----------------------------------------------------------------------
 // Author: Makoto Kewish
 // File:   avl_collection.h
@@ -16,38 +15,249 @@
 #include <vector>
 #include <algorithm>
 #include <string>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <iterator>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <compare>
+#include <thread>
+#include <atomic>
+#include <cassert>
 #include "collection.h"
+#include "slab_allocator.h"
+
+
+// node augmentation policies: OrderStatistics keeps the size of each
+// subtree in its root node, which makes rank, select and range counts
+// O(log n); NoOrderStatistics adds nothing to the nodes
+struct NoOrderStatistics {};
+struct OrderStatistics {};
+
+
+// per-node data required by a policy (empty by default)
+template<typename Stats>
+struct AVLNodeStats
+{
+  static int size_of(const AVLNodeStats* subtree_root) { return 0; }
+  void update(const AVLNodeStats* left, const AVLNodeStats* right) {}
+};
+
+
+// subtree size kept for order statistics
+template<>
+struct AVLNodeStats<OrderStatistics>
+{
+  int subtree_size;
+  static int size_of(const AVLNodeStats* subtree_root)
+  {
+    return subtree_root ? subtree_root -> subtree_size : 0;
+  }
+  void update(const AVLNodeStats* left, const AVLNodeStats* right)
+  {
+    subtree_size = 1 + size_of(left) + size_of(right);
+  }
+};
+
+
+// operation counters, compiled in only when AVL_COUNTERS is defined
+// (cmake -DAVL_COUNTERS=ON); otherwise they stay zero and counting
+// costs nothing. a double rotation counts once, not as two single
+// ones
+struct AVLOpCounters {
+  long comparisons = 0;
+  long single_rotations = 0;
+  long double_rotations = 0;
+  long node_visits = 0;
+  long allocations = 0;
+};
+
+
+// the counts a collection keeps: relaxed atomics, since readers
+// sharing a lock (and set operation threads) count at the same time
+struct AVLAtomicOpCounters {
+  std::atomic<long> comparisons{0};
+  std::atomic<long> single_rotations{0};
+  std::atomic<long> double_rotations{0};
+  std::atomic<long> node_visits{0};
+  std::atomic<long> allocations{0};
+
+  // copy out the current counts
+  AVLOpCounters load() const;
+
+  // zero every count
+  void reset();
+};
+
+
+inline AVLOpCounters AVLAtomicOpCounters::load() const
+{
+  AVLOpCounters counts;
+  counts.comparisons = comparisons.load(std::memory_order_relaxed);
+  counts.single_rotations = single_rotations.load(std::memory_order_relaxed);
+  counts.double_rotations = double_rotations.load(std::memory_order_relaxed);
+  counts.node_visits = node_visits.load(std::memory_order_relaxed);
+  counts.allocations = allocations.load(std::memory_order_relaxed);
+  return counts;
+}
+
+
+inline void AVLAtomicOpCounters::reset()
+{
+  comparisons.store(0, std::memory_order_relaxed);
+  single_rotations.store(0, std::memory_order_relaxed);
+  double_rotations.store(0, std::memory_order_relaxed);
+  node_visits.store(0, std::memory_order_relaxed);
+  allocations.store(0, std::memory_order_relaxed);
+}
+
+
+// shape of a collection at one moment: depths count nodes from the
+// root (so max_depth is the height), and each node is left heavy,
+// balanced or right heavy by one level
+struct AVLTreeStats {
+  int size = 0;
+  int height = 0;
+  double average_depth = 0;
+  int max_depth = 0;
+  long left_heavy = 0;
+  long balanced = 0;
+  long right_heavy = 0;
+  std::size_t memory_bytes = 0;
+  AVLOpCounters counters;
+};
+
+
+// default key comparison: compare(a, b) returns a value that is < 0,
+// == 0 or > 0 (as a <=> b does) so each step down the tree costs one
+// comparison. types without <=> fall back to operator<. the comparison
+// is transparent: lookups may pass any type comparable with the keys
+// (e.g. a std::string_view for std::string keys)
+struct ThreeWayCompare
+{
+  typedef void is_transparent;
+
+  template<typename A, typename B>
+  auto operator()(const A& lhs, const B& rhs) const
+  {
+    if constexpr (requires { lhs <=> rhs; })
+      return lhs <=> rhs;
+    else
+      return lhs < rhs ? -1 : (rhs < lhs ? 1 : 0);
+  }
+};
+
+
+// read-only Eytzinger-layout image of a collection (see
+// frozen_avl_collection.h)
+template<typename K, typename V, typename Compare>
+class FrozenAVLCollection;
 
 
-template<typename K, typename V>
+// Compare is a three-way key comparison (see above). Alloc is the node
+// allocator; by default nodes are carved out of large blocks by a
+// SlabAllocator (see slab_allocator.h). Stats is a node augmentation
+// policy (see above)
+template<typename K, typename V, typename Compare = ThreeWayCompare,
+         template<typename> class Alloc = SlabAllocator,
+         typename Stats = NoOrderStatistics>
 class AVLCollection : public Collection<K,V>
 {
+private:
+
+  // avl tree node (defined below)
+  struct Node;
+
 public:
 
+  // key-value pair as seen through an iterator
+  struct Entry {
+    K key;
+    V value;
+  };
+
+  // bidirectional iterator over the pairs in key order. the iterator
+  // keeps the path from the root to its node in a fixed array, so
+  // stepping through the tree never allocates. any add or remove
+  // invalidates all iterators
+  class const_iterator;
+  typedef const_iterator iterator;
+
   // create an empty tree
   AVLCollection();
 
+  // build a balanced tree from a range of (key, value) pairs
+  template<typename Iter>
+  AVLCollection(Iter first, Iter last);
+
   // tree copy constructor
-  AVLCollection(const AVLCollection<K,V>& rhs);
+  AVLCollection(const AVLCollection<K,V,Compare,Alloc,Stats>& rhs);
+
+  // tree move constructor
+  AVLCollection(AVLCollection<K,V,Compare,Alloc,Stats>&& rhs);
 
   // tree assignment operator
-  AVLCollection<K,V>& operator=(const AVLCollection<K,V>& rhs);
+  AVLCollection<K,V,Compare,Alloc,Stats>& operator=(const AVLCollection<K,V,Compare,Alloc,Stats>& rhs);
+
+  // tree move assignment operator
+  AVLCollection<K,V,Compare,Alloc,Stats>& operator=(AVLCollection<K,V,Compare,Alloc,Stats>&& rhs);
 
   // delete a tree
   ~AVLCollection();
 
+  // build a balanced tree from a range of (key, value) pairs
+  template<typename Iter>
+  static AVLCollection<K,V,Compare,Alloc,Stats> from_sorted(Iter first, Iter last);
+
+  // replace the contents with a range of (key, value) pairs; linear
+  // time if the range is sorted by key, otherwise it is sorted first
+  template<typename Iter>
+  void bulk_load(Iter first, Iter last);
+
   // add a new key-value pair into the collection
   void add(const K& a_key, const V& a_val);
 
-  // remove a key-value pair from the collectiona
-  void remove(const K& a_key);
+  // remove a key-value pair from the collection, returns false if
+  // the key isn't in the collection
+  bool remove(const K& a_key);
+
+  // remove a key-value pair, the key may be of any type the
+  // comparison accepts
+  template<typename KeyLike>
+  bool remove(const KeyLike& a_key);
+
+  // remove a key-value pair and return the value that was removed
+  template<typename KeyLike>
+  bool remove(const KeyLike& a_key, V& the_val);
 
   // find and return the value associated with the key
   bool find(const K& search_key, V& the_val) const;
 
+  // find and return the value associated with a key of any type the
+  // comparison accepts
+  template<typename KeyLike>
+  bool find(const KeyLike& search_key, V& the_val) const;
+
+  // look up many keys at once, vals[i] receives the value of
+  // search_keys[i] (or nothing), so vals must be at least as long as
+  // search_keys; the lookups walk the tree together so their cache
+  // misses overlap
+  void find_batch(std::span<const K> search_keys, std::span<std::optional<V>> vals) const;
+
   // find and return the values with keys >= to k1 and <= to k2
   void find(const K& k1, const K& k2, std::vector<V>& vals) const;
 
+  // same as above for bounds of any type the comparison accepts
+  template<typename Low, typename High>
+  void find(const Low& k1, const High& k2, std::vector<V>& vals) const;
+
+  // call visit(key, value) for each pair with k1 <= key <= k2, in
+  // key order
+  template<typename Low, typename High, typename Visitor>
+  void visit_range(const Low& k1, const High& k2, Visitor visit) const;
+
   // return all of the keys in the collection
   void keys(std::vector<K>& all_keys) const;
 
@@ -60,36 +270,242 @@ public:
   // return the height of the tree
   int height() const;
 
+  // return the number of nodes handed out by the node allocator
+  long node_allocations() const;
+
+  // return the number of allocations the node allocator made on the heap
+  long heap_allocations() const;
+
+  // return the number of bytes used by the collection and its nodes
+  std::size_t memory_bytes() const;
+
+  // true if this build counts operations (see AVLOpCounters)
+  static constexpr bool counting =
+#ifdef AVL_COUNTERS
+    true;
+#else
+    false;
+#endif
+
+  // return the operation counts since the collection was created or
+  // the counters were last reset
+  AVLOpCounters counters() const;
+
+  // zero the operation counters
+  void reset_counters();
+
+  // return the size, height, depth and balance distribution, memory
+  // use and operation counts, walking the whole tree
+  AVLTreeStats stats() const;
+
+  // true if the node allocator's pool is shared with another
+  // collection (after split), so neither may be used concurrently
+  // with the other
+  bool shares_allocator() const;
+
+  // empty the collection, leaving its nodes to be destroyed on a
+  // background thread; if the node allocator is shared with another
+  // collection (after split) the nodes are destroyed here instead and
+  // false is returned. The destructor waits for the background work.
+  bool clear_in_background();
+
+  // wait until the nodes given up by clear_in_background are destroyed
+  void wait_for_clear();
+
+  // return a read-only copy laid out for fast searches (defined in
+  // frozen_avl_collection.h)
+  FrozenAVLCollection<K,V,Compare> freeze() const;
+
+  // move the pairs with keys >= key into a new collection and return
+  // it, keeping the pairs with keys < key. the two collections share
+  // this allocator, whose pool isn't synchronized: don't use them from
+  // different threads (copy one half first, which gives it its own
+  // pool). O(log n) with OrderStatistics, otherwise counting the
+  // smaller part adds time proportional to its size
+  AVLCollection<K,V,Compare,Alloc,Stats> split(const K& key);
+
+  // append a_key/a_val and then the pairs of right, whose keys must
+  // all be greater than a_key (and a_key greater than every key here);
+  // O(|height difference|). right is left empty
+  void join(const K& a_key, const V& a_val, AVLCollection<K,V,Compare,Alloc,Stats>&& right);
+
+  // append the pairs of right, whose keys must all be greater than
+  // every key here. right is left empty
+  void join(AVLCollection<K,V,Compare,Alloc,Stats>&& right);
+
+  // set operations in O(m log(n/m + 1)) for sizes m <= n, built on
+  // split and join: union_with adds the pairs of other whose keys
+  // aren't here, intersect_with keeps only the keys also in other,
+  // difference drops the keys that are in other. pairs already here
+  // keep their values. other is left empty; its nodes are reused (or
+  // copied first if it uses a different allocator). large inputs are
+  // divided between up to threads threads (fork-join)
+  void union_with(AVLCollection<K,V,Compare,Alloc,Stats>&& other, int threads = 1);
+  void intersect_with(AVLCollection<K,V,Compare,Alloc,Stats>&& other, int threads = 1);
+  void difference(AVLCollection<K,V,Compare,Alloc,Stats>&& other, int threads = 1);
+
+  // add a batch of (key, value) pairs; keys already in the collection
+  // take the batch's value, and the last of equal keys in the batch
+  // wins. the sorted batch is divided at the tree's keys and the parts
+  // are linked into disjoint subtrees on up to threads threads
+  void insert_batch(std::vector<std::pair<K,V>> kvs, int threads = 1);
+
+  // remove a batch of keys in the same way, returns the number of pairs
+  // removed
+  int erase_batch(std::vector<K> batch_keys, int threads = 1);
+
+  // iterator to the smallest key
+  const_iterator begin() const;
+
+  // iterator past the largest key
+  const_iterator end() const;
+
+  // iterator to the first key >= search_key
+  template<typename KeyLike>
+  const_iterator lower_bound(const KeyLike& search_key) const;
+
+  // iterator to the first key > search_key
+  template<typename KeyLike>
+  const_iterator upper_bound(const KeyLike& search_key) const;
+
+  // lower_bound and upper_bound of search_key
+  template<typename KeyLike>
+  std::pair<const_iterator, const_iterator> equal_range(const KeyLike& search_key) const;
+
+  // number of keys < search_key (OrderStatistics only)
+  template<typename KeyLike>
+  int rank(const KeyLike& search_key) const;
+
+  // iterator to the i-th smallest key, counting from 0, or end if i is
+  // out of range (OrderStatistics only)
+  const_iterator select(int i) const;
+
+  // number of keys >= k1 and <= k2 (OrderStatistics only)
+  template<typename Low, typename High>
+  int count_range(const Low& k1, const High& k2) const;
+
+  class const_iterator
+  {
+  public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef Entry value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const Entry* pointer;
+    typedef const Entry& reference;
+
+    // create an end iterator of an empty tree
+    const_iterator();
+
+    reference operator*() const;
+    pointer operator->() const;
+    const_iterator& operator++();
+    const_iterator operator++(int);
+    const_iterator& operator--();
+    const_iterator operator--(int);
+    bool operator==(const const_iterator& rhs) const;
+    bool operator!=(const const_iterator& rhs) const;
+
+  private:
+    friend class AVLCollection<K,V,Compare,Alloc,Stats>;
+
+    // an AVL tree of 2^31 nodes is less than 45 high
+    static const int max_depth = 64;
+
+    // push subtree_root and its leftmost (or rightmost) descendants
+    void push_leftmost(const Node* subtree_root);
+    void push_rightmost(const Node* subtree_root);
+
+    // root of the tree (used to step back from end)
+    const Node* root;
+    // path from the root to the current node, empty at end
+    const Node* path[max_depth];
+    int depth;
+  };
+
 private:
 
+  // policy data kept in each node
+  typedef AVLNodeStats<Stats> NodeStats;
+
   // avl tree node structure
-  struct Node {
-    K key;
-    V value;
+  struct Node : Entry, NodeStats {
     int height;
     Node* left;
     Node* right;
+    Node(const K& a_key, const V& a_val)
+      : Entry{a_key, a_val}, height(1), left(nullptr), right(nullptr)
+    {
+      NodeStats::update(nullptr, nullptr);
+    }
   };
 
-  // helper to empty entire tree
+  // true if lookups may compare other types against K directly
+  static constexpr bool transparent = requires { typename Compare::is_transparent; };
+
+  // a lookup key as it is compared against the tree: unchanged if the
+  // comparison is transparent, otherwise converted to K (once)
+  template<typename KeyLike>
+  static decltype(auto) lookup_key(const KeyLike& search_key);
+
+  // node holding search_key, or nullptr
+  template<typename KeyLike>
+  const Node* find_node(const KeyLike& search_key) const;
+
+  // number of keys < search_key (or <= search_key if inclusive)
+  template<typename KeyLike>
+  int count_less(const KeyLike& search_key, bool inclusive) const;
+
+  // number of lookups find_batch keeps in flight at once
+  static const int batch_width = 16;
+
+  // hint the cache to load a node that will be visited soon
+  static void prefetch(const Node* node);
+
+  // add one to an operation counter (nothing unless counting)
+  void count_op(std::atomic<long> AVLAtomicOpCounters::* counter) const;
+
+  // three-way key comparison, counted
+  template<typename A, typename B>
+  auto compare_keys(const A& lhs, const B& rhs) const;
+
+  // allocate and construct a new leaf node
+  Node* create_node(const K& a_key, const V& a_val);
+
+  // destroy a node and return its storage to the allocator
+  void destroy_node(Node* node);
+
+  // helper to destroy every node of a subtree (the caller resets the
+  // links to it)
   void make_empty(Node* subtree_root);
 
   // helper to build sorted list of keys (used by keys and sort)
   void inorder(const Node* subtree_root, std::vector<K>& keys) const;
 
-  // helper to recursively find range of values
-  void range_search(const Node* subtree_root, const K& k1, const K& k2,
-                    std::vector<V>& vals) const;
+  // helper to visit the pairs in a range of keys
+  template<typename Low, typename High, typename Visitor>
+  void range_search(const Node* subtree_root, const Low& k1, const High& k2,
+                    Visitor& visit) const;
 
-  // recursively (deep) copy ancestors of src to dst
-  void preorder_copy(const Node* subtree_root_src, Node* subtree_root_dst);
+  // iteratively (deep) copy a subtree, keeping its shape and heights
+  Node* clone(const Node* subtree_root_src);
+
+  // copy a single node, without its children
+  Node* copy_node(const Node* src);
 
   // helper function to remove a node recursively
-  Node* remove(const K& key, Node* subtree_root);
+  template<typename KeyLike>
+  Node* remove(const KeyLike& key, Node* subtree_root, Node*& removed);
+
+  // helper to unlink the leftmost node of a subtree
+  Node* remove_min(Node* subtree_root, Node*& min_node);
 
   // recursive add helper
   Node* add(Node* subtree_root, const K& a_key, const V& a_val);
 
+  // build a balanced subtree from the next n pairs of a sorted range
+  template<typename Iter>
+  Node* build_sorted(Iter& next, int n);
+
   // rotate right helper
   Node* rotate_right(Node* k2);
 
@@ -99,29 +515,119 @@ private:
   // rebalance the subtree rooted at subtree_root
   Node* rebalance(Node* subtree_root);
 
+  // height of a possibly empty subtree
+  static int node_height(const Node* subtree_root);
+
+  // recompute a node's height (and policy data) from its children
+  static void update_height(Node* subtree_root);
+
+  // nodes dropped and keys matched by a set operation; nodes are
+  // freed after any parallel work is done, since the allocator isn't
+  // thread-safe
+  struct SetWork {
+    std::vector<Node*> dropped;
+    int matches = 0;
+  };
+
+  // set operations fork while the first input is at least this high
+  static const int parallel_height = 14;
+
+  // join two subtrees and a middle node whose key lies between them
+  Node* join_nodes(Node* left, Node* middle, Node* right);
+
+  // join two subtrees, every key of left less than every key of right
+  Node* join_nodes(Node* left, Node* right);
+
+  // split a subtree into the keys < key and > key, returning the
+  // detached node holding key (or nullptr)
+  Node* split_nodes(Node* subtree_root, const K& key, Node*& left, Node*& right);
+
+  // recursive set operation helpers; forks is the number of threads
+  // the call may use
+  Node* union_nodes(Node* a, Node* b, SetWork& work, int forks);
+  Node* intersect_nodes(Node* a, Node* b, SetWork& work, int forks);
+  Node* difference_nodes(Node* a, Node* b, SetWork& work, int forks);
+
+  // batches at least this long are divided between threads
+  static const int parallel_batch = 4096;
+
+  // link a sorted batch of new nodes into a subtree, replacing nodes
+  // with equal keys
+  Node* insert_nodes(Node* subtree_root, std::span<Node* const> batch, SetWork& work, int forks);
+
+  // unlink the nodes whose keys are in a sorted batch
+  Node* erase_nodes(Node* subtree_root, std::span<const K> batch, SetWork& work, int forks);
+
+  // link sorted unattached nodes into a balanced subtree
+  static Node* link_sorted(std::span<Node* const> nodes);
+
+  // run left_op(work, forks) and right_op(work, forks), on two threads
+  // if the inputs are large and forks allows it
+  template<typename LeftOp, typename RightOp>
+  void fork_join(LeftOp left_op, RightOp right_op, bool large, SetWork& work, int forks);
+
+  // take other's tree, copying it into this allocator if needed
+  Node* adopt(AVLCollection<K,V,Compare,Alloc,Stats>& other);
+
+  // add every node of a subtree to a set operation's dropped nodes
+  static void drop_nodes(Node* subtree_root, SetWork& work);
+
+  // free the nodes a set operation dropped
+  void release_dropped(SetWork& work);
+
+  // size of the smaller of two subtrees, found by walking both in
+  // step; a_smaller says which one it was
+  static int smaller_size(const Node* a, const Node* b, bool& a_smaller);
+
   // number of k-v pairs in the collection
   int tree_size;
 
   // root node of tree
   Node* root;
 
+  // three-way key comparison
+  Compare compare;
+
+  // allocator that supplies the tree's nodes
+  Alloc<Node> node_alloc;
+
+#ifdef AVL_COUNTERS
+  // operation counts (mutable so lookups can count)
+  mutable AVLAtomicOpCounters op_counters;
+#endif
+
+  // thread destroying the nodes given up by clear_in_background
+  // (joined on destruction)
+  std::jthread background;
+
   // for testing only: "pretty" prints a tree with node heights
   void print_tree(std::string indent, Node* subtree_root);
 };
 
 
 // constructs an AVL tree key-value pair collection
-template<typename K, typename V>
-AVLCollection<K,V>::AVLCollection()
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLCollection<K,V,Compare,Alloc,Stats>::AVLCollection()
 {
   root = nullptr;
   tree_size = 0;
 }
 
 
+// constructs a collection holding the pairs in [first, last)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename Iter>
+AVLCollection<K,V,Compare,Alloc,Stats>::AVLCollection(Iter first, Iter last)
+{
+  root = nullptr;
+  tree_size = 0;
+  bulk_load(first, last);
+}
+
+
 // copy constructor, utilizes operator=
-template<typename K, typename V>
-AVLCollection<K,V>::AVLCollection(const AVLCollection<K,V>& rhs)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLCollection<K,V,Compare,Alloc,Stats>::AVLCollection(const AVLCollection<K,V,Compare,Alloc,Stats>& rhs)
 {
   root = nullptr;
   tree_size = 0;
@@ -129,33 +635,107 @@ AVLCollection<K,V>::AVLCollection(const AVLCollection<K,V>& rhs)
 }
 
 
+// move constructor, takes over rhs's nodes and allocator and leaves
+// rhs empty with a fresh allocator
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLCollection<K,V,Compare,Alloc,Stats>::AVLCollection(AVLCollection<K,V,Compare,Alloc,Stats>&& rhs)
+{
+  root = rhs.root;
+  tree_size = rhs.tree_size;
+  std::swap(node_alloc, rhs.node_alloc);
+  rhs.root = nullptr;
+  rhs.tree_size = 0;
+}
+
+
 // assignment operator (=)for two unique AVL trees
-template<typename K, typename V>
-AVLCollection<K,V>& AVLCollection<K,V>::operator=(const AVLCollection<K,V>& rhs)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLCollection<K,V,Compare,Alloc,Stats>& AVLCollection<K,V,Compare,Alloc,Stats>::operator=(const AVLCollection<K,V,Compare,Alloc,Stats>& rhs)
 {
   if(this != &rhs)
   {
     make_empty(root);
-    root = nullptr;
-    tree_size = 0;
-    preorder_copy(rhs.root, root);
+    root = clone(rhs.root);
+    tree_size = rhs.tree_size;
+  }
+  return *this;
+}
+
+
+// move assignment operator, empties this tree and then trades nodes
+// and allocators with rhs
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLCollection<K,V,Compare,Alloc,Stats>& AVLCollection<K,V,Compare,Alloc,Stats>::operator=(AVLCollection<K,V,Compare,Alloc,Stats>&& rhs)
+{
+  if(this != &rhs)
+  {
+    make_empty(root);
+    root = rhs.root;
+    tree_size = rhs.tree_size;
+    std::swap(node_alloc, rhs.node_alloc);
+    rhs.root = nullptr;
+    rhs.tree_size = 0;
   }
   return *this;
 }
 
 
 // destroys an AVL tree collection
-template<typename K, typename V>
-AVLCollection<K,V>::~AVLCollection()
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLCollection<K,V,Compare,Alloc,Stats>::~AVLCollection()
+{
+  // nodes that need no destructor can go back to the heap block by
+  // block, without visiting them
+  if(!std::is_trivially_destructible<Node>::value || !node_alloc.release())
+    make_empty(root);
+  root = nullptr;
+  tree_size = 0;
+}
+
+
+// returns a collection holding the pairs in [first, last)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename Iter>
+AVLCollection<K,V,Compare,Alloc,Stats> AVLCollection<K,V,Compare,Alloc,Stats>::from_sorted(Iter first, Iter last)
+{
+  return AVLCollection<K,V,Compare,Alloc,Stats>(first, last);
+}
+
+
+// empties the collection and builds a height-balanced tree bottom-up
+// from the pairs in [first, last), sorting a copy if needed
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename Iter>
+void AVLCollection<K,V,Compare,Alloc,Stats>::bulk_load(Iter first, Iter last)
 {
   make_empty(root);
+  root = nullptr;
   tree_size = 0;
+
+  typedef typename std::iterator_traits<Iter>::value_type Pair;
+  auto key_less = [this](const Pair& lhs, const Pair& rhs) {
+    return compare_keys(lhs.first, rhs.first) < 0;
+  };
+  if(std::is_sorted(first, last, key_less))
+  {
+    int n = std::distance(first, last);
+    root = build_sorted(first, n);
+    tree_size = n;
+    return;
+  }
+
+  // unsorted input: sort a copy, keeping equal keys in input order
+  std::vector<Pair> sorted_pairs(first, last);
+  std::stable_sort(sorted_pairs.begin(), sorted_pairs.end(), key_less);
+  typename std::vector<Pair>::const_iterator next = sorted_pairs.begin();
+  root = build_sorted(next, sorted_pairs.size());
+  tree_size = sorted_pairs.size();
 }
 
 
 // calls the add helper function to add a node into the collection
-template<typename K, typename V>
-void AVLCollection<K,V>::add(const K& a_key, const V& a_val)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::add(const K& a_key, const V& a_val)
 {
   root = add(root, a_key, a_val);
   //print_tree("", root); // for debugging
@@ -164,72 +744,169 @@ void AVLCollection<K,V>::add(const K& a_key, const V& a_val)
 
 
 // calls the remove helper function to remove a node from the collection
-template <typename K, typename V>
-void AVLCollection<K,V>::remove(const K& a_key)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::remove(const K& a_key)
 {
-  root = remove(a_key, root);
-  //print_tree("", root); // for debugging
-  //std::cout << std::endl;
+  return remove<K>(a_key);
+}
+
+
+// calls the remove helper function to remove a node from the collection
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::remove(const KeyLike& a_key)
+{
+  Node* removed = nullptr;
+  root = remove(lookup_key(a_key), root, removed);
+  if(removed == nullptr)
+    return false;
+  destroy_node(removed);
+  tree_size--;
+  return true;
+}
+
+
+// removes a node from the collection, handing back its value
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::remove(const KeyLike& a_key, V& the_val)
+{
+  Node* removed = nullptr;
+  root = remove(lookup_key(a_key), root, removed);
+  if(removed == nullptr)
+    return false;
+  the_val = std::move(removed -> value);
+  destroy_node(removed);
+  tree_size--;
+  return true;
 }
 
 
 // finds a key-value pair in the collection and returns its associated value
-template<typename K, typename V>
-bool AVLCollection<K,V>::find(const K& search_key, V& the_val) const
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::find(const K& search_key, V& the_val) const
 {
-  Node* cur = root;
-  while(cur != nullptr)
+  return find<K>(search_key, the_val);
+}
+
+
+// finds a key-value pair by a key of another type and returns its value
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::find(const KeyLike& search_key, V& the_val) const
+{
+  const Node* node = find_node(lookup_key(search_key));
+  if(node == nullptr)
+    return false;
+  the_val = node -> value;
+  return true;
+}
+
+
+// runs the lookups in groups of batch_width: each round moves every
+// unfinished lookup of the group down one level and prefetches the
+// child it will compare against next, so the group waits on one
+// round of memory loads per level instead of one per lookup
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::find_batch(std::span<const K> search_keys,
+                                                std::span<std::optional<V>> vals) const
+{
+  assert(vals.size() >= search_keys.size());
+  const Node* cur[batch_width];
+  for(std::size_t first = 0; first < search_keys.size(); first += batch_width)
   {
-    if(search_key == cur -> key)
+    int n = std::min<std::size_t>(batch_width, search_keys.size() - first);
+    for(int i = 0; i < n; ++i)
     {
-      the_val = cur -> value;
-      return true;
+      cur[i] = root;
+      vals[first + i].reset();
+    }
+    int active = n;
+    while(active > 0)
+    {
+      active = 0;
+      for(int i = 0; i < n; ++i)
+      {
+        const Node* node = cur[i];
+        if(node == nullptr)
+          continue;
+        count_op(&AVLAtomicOpCounters::node_visits);
+        auto order = compare_keys(search_keys[first + i], node -> key);
+        if(order < 0)
+          node = node -> left;
+        else if(order > 0)
+          node = node -> right;
+        else {
+          vals[first + i] = node -> value;
+          node = nullptr;
+        }
+        cur[i] = node;
+        if(node != nullptr)
+        {
+          prefetch(node);
+          active++;
+        }
+      }
     }
-    else if(search_key < cur -> key)
-      cur = cur -> left;
-    else if(search_key > cur -> key)
-      cur = cur -> right;
   }
-  return false;
 }
 
 
 // calls the range-search helper function and collects all the values that fall
 // within the two keys
-template<typename K, typename V>
-void AVLCollection<K,V>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  find<K,K>(k1, k2, vals);
+}
+
+
+// same as above, with bounds of other types
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename Low, typename High>
+void AVLCollection<K,V,Compare,Alloc,Stats>::find(const Low& k1, const High& k2, std::vector<V>& vals) const
+{
+  auto collect = [&vals](const K& key, const V& val) { vals.push_back(val); };
+  range_search(root, lookup_key(k1), lookup_key(k2), collect);
+}
+
+
+// calls the range-search helper function with a caller-supplied visitor
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename Low, typename High, typename Visitor>
+void AVLCollection<K,V,Compare,Alloc,Stats>::visit_range(const Low& k1, const High& k2, Visitor visit) const
 {
-  range_search(root, k1, k2, vals);
+  range_search(root, lookup_key(k1), lookup_key(k2), visit);
 }
 
 
 // collections all the keys in the collection (uses in-order traversal)
-template<typename K, typename V>
-void AVLCollection<K,V>::keys(std::vector<K>& all_keys) const
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::keys(std::vector<K>& all_keys) const
 {
   inorder(root, all_keys);
 }
 
 
 // sorts all the keys in the AVL tree in ascending order (uses in-order traversal)
-template<typename K, typename V>
-void AVLCollection<K,V>::sort(std::vector<K>& all_keys_sorted) const
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::sort(std::vector<K>& all_keys_sorted) const
 {
   keys(all_keys_sorted);
 }
 
 
 // returns the number of key-value pairs in the collection
-template<typename K, typename V>
-int AVLCollection<K,V>::size() const
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+int AVLCollection<K,V,Compare,Alloc,Stats>::size() const
 {
   return tree_size;
 }
 
 
 // returns the height of a tree
-template<typename K, typename V>
-int AVLCollection<K,V>::height() const
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+int AVLCollection<K,V,Compare,Alloc,Stats>::height() const
 {
   if (!root)
     return 0;
@@ -237,334 +914,1327 @@ int AVLCollection<K,V>::height() const
 }
 
 
-//------------------------------------------------------------------------------
-// Helper Functions
-//------------------------------------------------------------------------------
+// returns the number of nodes handed out by the node allocator
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+long AVLCollection<K,V,Compare,Alloc,Stats>::node_allocations() const
+{
+  return node_alloc.allocations();
+}
 
 
-// empties the entire AVL tree using postorder traversal
-template<typename K, typename V>
-void AVLCollection<K,V>::make_empty(Node* subtree_root)
+// returns the number of heap allocations made by the node allocator
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+long AVLCollection<K,V,Compare,Alloc,Stats>::heap_allocations() const
 {
-  if(subtree_root == nullptr)
-  {
-    root = nullptr;
-    return;
-  }
-  make_empty(subtree_root -> left);
-  make_empty(subtree_root -> right);
-  delete subtree_root;
+  return node_alloc.heap_allocations();
 }
 
-// utilizes the in-order traversal method to collect all the keys in the collection
-template<typename K, typename V>
-void AVLCollection<K,V>::inorder(const Node* subtree_root, std::vector<K>& keys) const
+
+// counts the node allocator's storage (all of it, if the pool is shared)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+std::size_t AVLCollection<K,V,Compare,Alloc,Stats>::memory_bytes() const
 {
-  if(subtree_root == nullptr)
-    return;
-  inorder(subtree_root -> left, keys);
-  keys.push_back(subtree_root -> key);
-  inorder(subtree_root -> right, keys);
+  return sizeof(*this) + node_alloc.heap_bytes();
 }
 
 
-// finds nodes that fall within two keys and pushes its value into a vector collection
-template<typename K, typename V>
-void AVLCollection<K,V>::range_search(const Node* subtree_root, const K& k1, const K& k2,
-                  std::vector<V>& vals) const
+// returns all zeros unless counting
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLOpCounters AVLCollection<K,V,Compare,Alloc,Stats>::counters() const
 {
-  if(subtree_root == nullptr)
-    return;
-  if(subtree_root && k1 <= subtree_root -> key && k2 >= subtree_root -> key)
-  {
-    vals.push_back(subtree_root -> value);
-    if(subtree_root && k1 > subtree_root -> key)
-      subtree_root = subtree_root -> right;
-    if(subtree_root && k2 < subtree_root -> key)
-      subtree_root = subtree_root -> left;
-  }
-  range_search(subtree_root -> right, k1, k2, vals);
-  range_search(subtree_root -> left, k1, k2, vals);
+#ifdef AVL_COUNTERS
+  return op_counters.load();
+#else
+  return AVLOpCounters();
+#endif
 }
 
 
-// utilizes the preorder traversal method to copy elements into another AVL tree
-template<typename K, typename V>
-void AVLCollection<K,V>::preorder_copy(const Node* subtree_root_src, Node* subtree_root_dst)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::reset_counters()
 {
-  if(subtree_root_src == nullptr)
-    return;
-  add(subtree_root_src -> key, subtree_root_src -> value);
-  preorder_copy(subtree_root_src -> left, subtree_root_dst);
-  preorder_copy(subtree_root_src -> right, subtree_root_dst);
+#ifdef AVL_COUNTERS
+  op_counters.reset();
+#endif
 }
 
 
-// rotates nodes right, used for rebalancing
-template<typename K, typename V>
-typename AVLCollection<K,V>::Node*
-AVLCollection<K,V>::rotate_right(Node* k2)
+// walks the tree with an explicit stack of (node, depth) pairs
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLTreeStats AVLCollection<K,V,Compare,Alloc,Stats>::stats() const
 {
-  Node * k1 = k2 -> left;
-  k2 -> left = k1 -> right;
-  k1 -> right = k2;
-  return k1;
+  AVLTreeStats result;
+  result.size = tree_size;
+  result.height = height();
+  result.memory_bytes = memory_bytes();
+  result.counters = counters();
+  long total_depth = 0;
+  std::vector<std::pair<const Node*, int>> pending;
+  if(root != nullptr)
+    pending.push_back(std::make_pair(root, 1));
+  while(!pending.empty())
+  {
+    const Node* cur = pending.back().first;
+    int depth = pending.back().second;
+    pending.pop_back();
+    total_depth += depth;
+    result.max_depth = std::max(result.max_depth, depth);
+    int balance = node_height(cur -> left) - node_height(cur -> right);
+    if(balance > 0)
+      result.left_heavy++;
+    else if(balance < 0)
+      result.right_heavy++;
+    else
+      result.balanced++;
+    if(cur -> left != nullptr)
+      pending.push_back(std::make_pair(cur -> left, depth + 1));
+    if(cur -> right != nullptr)
+      pending.push_back(std::make_pair(cur -> right, depth + 1));
+  }
+  if(tree_size > 0)
+    result.average_depth = double(total_depth) / tree_size;
+  return result;
 }
 
 
-// rotates nodes left, used for rebalancing
-template<typename K, typename V>
-typename AVLCollection<K,V>::Node*
-AVLCollection<K,V>::rotate_left(Node* k2)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::shares_allocator() const
 {
-  Node * k1 = k2 -> right;
-  k2 -> right = k1 -> left;
-  k1 -> left = k2;
-  return k1;
+  return node_alloc.shared();
 }
 
 
-// rebalances the tree using rotate left and right operations
-template<typename K, typename V>
-typename AVLCollection<K,V>::Node*
-AVLCollection<K,V>::rebalance(Node* subtree_root)
+// moves the nodes and the allocator into a collection owned by a
+// background thread, which destroys it; this collection gets a fresh
+// allocator. The new thread takes over any earlier one and joins it
+// when done, so only the latest needs to be waited for
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::clear_in_background()
 {
-  if(!subtree_root)
-    return subtree_root;
-
-  Node* lptr = subtree_root -> left;
-  Node* rptr = subtree_root -> right;
+  if(node_alloc.shared())
+  {
+    make_empty(root);
+    root = nullptr;
+    tree_size = 0;
+    return false;
+  }
+  background = std::jthread([doomed = AVLCollection<K,V,Compare,Alloc,Stats>(std::move(*this)),
+                             previous = std::move(background)]() mutable {
+    AVLCollection<K,V,Compare,Alloc,Stats> local(std::move(doomed));
+  });
+  return true;
+}
 
-  // obtain left and right subtree heights
-  int heightL = 0;
-  int heightR = 0;
-  int tmpHeight;
-  if(lptr != nullptr)
-    heightL = lptr -> height;
-  if(rptr != nullptr)
-    heightR = rptr -> height;
 
-  // if left heavy (balance is greater than 1)
-  if(heightL - heightR > 1)
-  {
-    int heightLR = 0;
-    int heightLL = 0;
-    if(lptr -> left != nullptr)
-      heightLL = lptr -> left -> height;
-    if(lptr -> right != nullptr)
-      heightLR = lptr -> right -> height;
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::wait_for_clear()
+{
+  if(background.joinable())
+    background.join();
+}
 
-    // if left-right heavy, double rotate
-    if(heightLL <= heightLR)
-    {
-      tmpHeight = lptr -> right -> height;
-      subtree_root -> left = rotate_left(subtree_root -> left);
-      subtree_root = rotate_right(subtree_root);
-      subtree_root -> height++;
-      subtree_root -> left -> height--;
-      subtree_root -> right -> height = tmpHeight;
-    } else {
-      tmpHeight = lptr -> left -> height;
-      subtree_root = rotate_right(subtree_root);
-      subtree_root -> right -> height = tmpHeight;;
-    }
 
-    // if right heavy (balance is less than -1)
-  } else if(heightL - heightR < -1)
+// splits the tree and counts one side: the subtree sizes give it
+// directly with order statistics, otherwise the smaller side is counted
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLCollection<K,V,Compare,Alloc,Stats> AVLCollection<K,V,Compare,Alloc,Stats>::split(const K& key)
+{
+  AVLCollection<K,V,Compare,Alloc,Stats> upper;
+  upper.node_alloc = node_alloc;
+  Node* left = nullptr;
+  Node* right = nullptr;
+  Node* equal = split_nodes(root, key, left, right);
+  if(equal != nullptr)
   {
-    int heightRL = 0;
-    int heightRR = 0;
-    if(rptr -> left != nullptr)
-      heightRL = rptr -> left -> height;
-    if(rptr -> right != nullptr)
-      heightRR = rptr -> right -> height;
-
-    // if right-left heavy, double rotate
-    if(heightRL > heightRR)
-    {
-      tmpHeight = rptr -> left -> height;
-      subtree_root -> right = rotate_right(subtree_root -> right);
-      subtree_root = rotate_left(subtree_root);
-      subtree_root -> height++;
-      subtree_root -> right -> height--;
-      subtree_root -> left -> height = tmpHeight;
-    } else {
-      tmpHeight = rptr -> right -> height;
-      subtree_root = rotate_left(subtree_root);
-      subtree_root -> left -> height = tmpHeight;
-    }
+    equal -> left = equal -> right = nullptr;
+    update_height(equal);
+    right = join_nodes(nullptr, equal, right);
   }
-  return subtree_root;
+  root = left;
+  upper.root = right;
+
+  int left_size;
+  if constexpr (std::is_same<Stats, OrderStatistics>::value)
+    left_size = NodeStats::size_of(left);
+  else {
+    bool left_smaller;
+    int smaller = smaller_size(left, right, left_smaller);
+    left_size = left_smaller ? smaller : tree_size - smaller;
+  }
+  upper.tree_size = tree_size - left_size;
+  tree_size = left_size;
+  return upper;
 }
 
 
-// adds a key-value pair to the collection
-template<typename K, typename V>
-typename AVLCollection<K,V>::Node*
-AVLCollection<K,V>::add(Node* subtree_root, const K& a_key, const V& a_val)
+// the middle pair becomes a node of its own and is joined in
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::join(const K& a_key, const V& a_val,
+                                                  AVLCollection<K,V,Compare,Alloc,Stats>&& right)
 {
-  // if spot is open / null
-  if(!subtree_root)
-  {
-    Node* tmp = new Node;
-    tmp -> key = a_key;
-    tmp -> value = a_val;
-    tmp -> left = nullptr;
-    tmp -> right = nullptr;
-    subtree_root = tmp;
-    subtree_root -> height = 1;
-    tree_size++;
-  } else {
-    if(a_key < subtree_root -> key)
-      subtree_root -> left = add(subtree_root -> left, a_key, a_val);
-    else
-      subtree_root -> right = add(subtree_root -> right, a_key, a_val);
-
-    // reassigns new height values
-    int treeH = subtree_root -> height;
-    int heightL = 0;
-    int heightR = 0;
-    if(subtree_root -> left != nullptr)
-      heightL = subtree_root -> left -> height;
-    if(subtree_root -> right != nullptr)
-      heightR = subtree_root -> right -> height;
-
-    int biggerH = std::max(heightL, heightR);
-    if(treeH - biggerH <= 0)
-      subtree_root -> height++;
-  }
-  // rebalance after insertion
-  return rebalance(subtree_root);
+  int right_size = right.tree_size;
+  Node* right_root = adopt(right);
+  root = join_nodes(root, create_node(a_key, a_val), right_root);
+  tree_size += right_size + 1;
 }
 
 
-// removes a key-value pair from the collection
-template <typename K, typename V>
-typename AVLCollection<K,V>::Node*
-AVLCollection<K,V>::remove(const K& key, Node* subtree_root)
+// joins using the smallest node of right as the middle
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::join(AVLCollection<K,V,Compare,Alloc,Stats>&& right)
 {
-  int tmpHeight = subtree_root -> height;
-  V val;
+  int right_size = right.tree_size;
+  Node* right_root = adopt(right);
+  root = join_nodes(root, right_root);
+  tree_size += right_size;
+}
+
+
+// duplicate keys are counted as the recursion finds them
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::union_with(AVLCollection<K,V,Compare,Alloc,Stats>&& other,
+                                                        int threads)
+{
+  int other_size = other.tree_size;
+  Node* other_root = adopt(other);
+  SetWork work;
+  root = union_nodes(root, other_root, work, threads);
+  tree_size += other_size - work.matches;
+  release_dropped(work);
+}
+
+
+// the size is the number of keys found in both
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::intersect_with(AVLCollection<K,V,Compare,Alloc,Stats>&& other,
+                                                            int threads)
+{
+  Node* other_root = adopt(other);
+  SetWork work;
+  root = intersect_nodes(root, other_root, work, threads);
+  tree_size = work.matches;
+  release_dropped(work);
+}
+
+
+// the size drops by the number of keys found in both
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::difference(AVLCollection<K,V,Compare,Alloc,Stats>&& other,
+                                                        int threads)
+{
+  Node* other_root = adopt(other);
+  SetWork work;
+  root = difference_nodes(root, other_root, work, threads);
+  tree_size -= work.matches;
+  release_dropped(work);
+}
+
+
+// sorts the batch and allocates its nodes up front, so the threads
+// only relink nodes
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::insert_batch(std::vector<std::pair<K,V>> kvs, int threads)
+{
+  std::stable_sort(kvs.begin(), kvs.end(), [this](const std::pair<K,V>& lhs, const std::pair<K,V>& rhs) {
+    return compare_keys(lhs.first, rhs.first) < 0;
+  });
+  std::vector<Node*> batch;
+  batch.reserve(kvs.size());
+  for(std::size_t i = 0; i < kvs.size(); ++i)
+    if(i + 1 == kvs.size() || compare_keys(kvs[i].first, kvs[i + 1].first) != 0)
+      batch.push_back(create_node(kvs[i].first, kvs[i].second));
+
+  SetWork work;
+  root = insert_nodes(root, batch, work, threads);
+  tree_size += batch.size() - work.matches;
+  release_dropped(work);
+}
+
+
+// sorts the keys and drops repeats before dividing them
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+int AVLCollection<K,V,Compare,Alloc,Stats>::erase_batch(std::vector<K> batch_keys, int threads)
+{
+  std::sort(batch_keys.begin(), batch_keys.end(), [this](const K& lhs, const K& rhs) {
+    return compare_keys(lhs, rhs) < 0;
+  });
+  auto last = std::unique(batch_keys.begin(), batch_keys.end(), [this](const K& lhs, const K& rhs) {
+    return compare_keys(lhs, rhs) == 0;
+  });
+  batch_keys.erase(last, batch_keys.end());
+
+  SetWork work;
+  root = erase_nodes(root, batch_keys, work, threads);
+  tree_size -= work.matches;
+  release_dropped(work);
+  return work.matches;
+}
 
-  // checks if key is in the collection
-  bool found = find(key, val);
-  if(found == false)
-    return subtree_root;
 
-  if(subtree_root && key < subtree_root -> key)
+// returns an iterator to the smallest key in the collection
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator
+AVLCollection<K,V,Compare,Alloc,Stats>::begin() const
+{
+  const_iterator it;
+  it.root = root;
+  it.push_leftmost(root);
+  return it;
+}
+
+
+// returns the iterator that follows the largest key
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator
+AVLCollection<K,V,Compare,Alloc,Stats>::end() const
+{
+  const_iterator it;
+  it.root = root;
+  return it;
+}
+
+
+// descends towards search_key, remembering the path; the answer is the
+// last node where the search turned left (the path is cut back to it)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator
+AVLCollection<K,V,Compare,Alloc,Stats>::lower_bound(const KeyLike& search_key) const
+{
+  const auto& key = lookup_key(search_key);
+  const_iterator it;
+  it.root = root;
+  int found_depth = 0;
+  const Node* cur = root;
+  while(cur != nullptr)
   {
-    subtree_root -> left = remove(key, subtree_root -> left);
+    it.path[it.depth++] = cur;
+    count_op(&AVLAtomicOpCounters::node_visits);
+    if(compare_keys(key, cur -> key) > 0)
+      cur = cur -> right;
+    else {
+      found_depth = it.depth;
+      cur = cur -> left;
+    }
+  }
+  it.depth = found_depth;
+  return it;
+}
+
 
-    // update the height of ancestor nodes
-    if(!subtree_root -> right)
-      subtree_root -> height--;
-    else if(subtree_root -> left)
+// same as lower_bound, but equal keys send the search right
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator
+AVLCollection<K,V,Compare,Alloc,Stats>::upper_bound(const KeyLike& search_key) const
+{
+  const auto& key = lookup_key(search_key);
+  const_iterator it;
+  it.root = root;
+  int found_depth = 0;
+  const Node* cur = root;
+  while(cur != nullptr)
+  {
+    it.path[it.depth++] = cur;
+    count_op(&AVLAtomicOpCounters::node_visits);
+    if(compare_keys(key, cur -> key) < 0)
     {
-      if(subtree_root -> right -> height < subtree_root -> left -> height)
-      {
-        if(subtree_root -> height - subtree_root -> left -> height > 1)
-          subtree_root -> height--;
-      } else if(subtree_root -> left -> height == subtree_root -> right -> height) {
-        if(subtree_root -> height - subtree_root -> left -> height > 1)
-          subtree_root -> height--;
-        }
+      found_depth = it.depth;
+      cur = cur -> left;
+    } else
+      cur = cur -> right;
+  }
+  it.depth = found_depth;
+  return it;
+}
+
+
+// returns the range of pairs whose key equals search_key
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+std::pair<typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator,
+          typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator>
+AVLCollection<K,V,Compare,Alloc,Stats>::equal_range(const KeyLike& search_key) const
+{
+  return std::make_pair(lower_bound(search_key), upper_bound(search_key));
+}
+
+
+// counts the keys below search_key, adding up left subtree sizes
+// wherever the search turns right
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+int AVLCollection<K,V,Compare,Alloc,Stats>::rank(const KeyLike& search_key) const
+{
+  return count_less(lookup_key(search_key), false);
+}
+
+
+// walks down using subtree sizes, remembering the path for the iterator
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator
+AVLCollection<K,V,Compare,Alloc,Stats>::select(int i) const
+{
+  static_assert(std::is_same<Stats, OrderStatistics>::value,
+                "select requires the OrderStatistics policy");
+  const_iterator it;
+  it.root = root;
+  if(i < 0 || i >= tree_size)
+    return it;
+  const Node* cur = root;
+  while(cur != nullptr)
+  {
+    it.path[it.depth++] = cur;
+    int left_size = NodeStats::size_of(cur -> left);
+    if(i < left_size)
+      cur = cur -> left;
+    else if(i == left_size)
+      return it;
+    else {
+      i -= left_size + 1;
+      cur = cur -> right;
     }
-    // rebalances as it backtracks
-    subtree_root = rebalance(subtree_root);
+  }
+  return it;
+}
+
+
+// counts the keys in [k1, k2] as the difference of two ranks
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename Low, typename High>
+int AVLCollection<K,V,Compare,Alloc,Stats>::count_range(const Low& k1, const High& k2) const
+{
+  int count = count_less(lookup_key(k2), true) - count_less(lookup_key(k1), false);
+  return std::max(count, 0);
+}
+
+
+//------------------------------------------------------------------------------
+// Iterator
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::const_iterator()
+  : root(nullptr), depth(0)
+{
+}
+
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::reference
+AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::operator*() const
+{
+  return *path[depth - 1];
+}
+
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::pointer
+AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::operator->() const
+{
+  return path[depth - 1];
+}
+
+
+// moves to the inorder successor: the leftmost node of the right
+// subtree if there is one, otherwise the nearest ancestor reached from
+// its left child
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator&
+AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::operator++()
+{
+  const Node* cur = path[depth - 1];
+  if(cur -> right != nullptr)
+  {
+    push_leftmost(cur -> right);
+    return *this;
+  }
+  depth--;
+  while(depth > 0 && path[depth - 1] -> right == cur)
+    cur = path[--depth];
+  return *this;
+}
+
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator
+AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::operator++(int)
+{
+  const_iterator tmp = *this;
+  ++*this;
+  return tmp;
+}
+
+
+// moves to the inorder predecessor (mirror of ++); stepping back from
+// end lands on the largest key
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator&
+AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::operator--()
+{
+  if(depth == 0)
+  {
+    push_rightmost(root);
+    return *this;
+  }
+  const Node* cur = path[depth - 1];
+  if(cur -> left != nullptr)
+  {
+    push_rightmost(cur -> left);
+    return *this;
+  }
+  depth--;
+  while(depth > 0 && path[depth - 1] -> left == cur)
+    cur = path[--depth];
+  return *this;
+}
+
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator
+AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::operator--(int)
+{
+  const_iterator tmp = *this;
+  --*this;
+  return tmp;
+}
+
+
+// iterators are equal if they sit on the same node (or are both at end)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::operator==(const const_iterator& rhs) const
+{
+  if(depth == 0 || rhs.depth == 0)
+    return depth == rhs.depth;
+  return path[depth - 1] == rhs.path[rhs.depth - 1];
+}
+
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+  return !(*this == rhs);
+}
+
 
-  } else if(subtree_root && key > subtree_root -> key)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::push_leftmost(const Node* subtree_root)
+{
+  while(subtree_root != nullptr)
   {
-    subtree_root -> right = remove(key, subtree_root -> right);
+    path[depth++] = subtree_root;
+    subtree_root = subtree_root -> left;
+  }
+}
 
-    // update the height of ancestor nodes
-    if(!subtree_root -> left)
-      subtree_root -> height--;
-    else if(subtree_root -> right)
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::const_iterator::push_rightmost(const Node* subtree_root)
+{
+  while(subtree_root != nullptr)
+  {
+    path[depth++] = subtree_root;
+    subtree_root = subtree_root -> right;
+  }
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+// takes storage from the allocator and builds a leaf node in it
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::create_node(const K& a_key, const V& a_val)
+{
+  count_op(&AVLAtomicOpCounters::allocations);
+  return new (node_alloc.allocate()) Node(a_key, a_val);
+}
+
+
+// runs the node's destructor and hands its storage back to the allocator
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::destroy_node(Node* node)
+{
+  node -> ~Node();
+  node_alloc.deallocate(node);
+}
+
+
+
+// destroys a subtree in constant extra space: a node with a left child
+// is rotated right until the leftmost node is on top, which then has
+// no left child and can be destroyed, leaving its right subtree. each
+// rotation moves one node onto the right spine for good, so this is
+// linear time
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::make_empty(Node* subtree_root)
+{
+  while(subtree_root != nullptr)
+  {
+    Node* lptr = subtree_root -> left;
+    if(lptr != nullptr)
     {
-      if(subtree_root -> left -> height < subtree_root -> right -> height)
-      {
-        if(subtree_root -> height - subtree_root -> right -> height > 1)
-          subtree_root -> height--;
-      } else if(subtree_root -> left -> height == subtree_root -> right -> height) {
-        if(subtree_root -> height - subtree_root -> right -> height > 1)
-          subtree_root -> height--;
-      }
+      subtree_root -> left = lptr -> right;
+      lptr -> right = subtree_root;
+      subtree_root = lptr;
+    } else {
+      Node* rest = subtree_root -> right;
+      destroy_node(subtree_root);
+      subtree_root = rest;
     }
-    // rebalances as it backtracks
-    subtree_root = rebalance(subtree_root);
+  }
+}
 
-  } else if(subtree_root && key == subtree_root -> key) {
-    Node* cur = subtree_root;
-    int prevHeight;
 
-    // hold on to height of subtree_root
-    tmpHeight = subtree_root -> height;
+// utilizes the in-order traversal method to collect all the keys in the
+// collection, with a fixed-size stack of the nodes still to visit (the
+// tree itself isn't modified, so concurrent readers are safe)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::inorder(const Node* subtree_root, std::vector<K>& keys) const
+{
+  const Node* stack[const_iterator::max_depth];
+  int depth = 0;
+  const Node* cur = subtree_root;
+  while(cur != nullptr || depth > 0)
+  {
+    while(cur != nullptr)
+    {
+      count_op(&AVLAtomicOpCounters::node_visits);
+      stack[depth++] = cur;
+      cur = cur -> left;
+    }
+    cur = stack[--depth];
+    keys.push_back(cur -> key);
+    cur = cur -> right;
+  }
+}
 
-    // if subtree_root doesn't have any children
-    if(subtree_root -> left == nullptr && subtree_root -> right == nullptr)
+
+// visits the nodes that fall within two keys in order (in-order
+// traversal), only stacking nodes >= k1 on the way down and stopping
+// at the first key > k2, so a search costs O(log n + k)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename Low, typename High, typename Visitor>
+void AVLCollection<K,V,Compare,Alloc,Stats>::range_search(const Node* subtree_root, const Low& k1, const High& k2,
+                  Visitor& visit) const
+{
+  const Node* stack[const_iterator::max_depth];
+  int depth = 0;
+  const Node* cur = subtree_root;
+  while(cur != nullptr || depth > 0)
+  {
+    while(cur != nullptr)
     {
-      subtree_root = nullptr;
-      delete cur;
-
-    // if subtree_root does have children, then it searches for its inorder successor
-    } else if(subtree_root -> left != nullptr && subtree_root -> right != nullptr) {
-      Node* prev = subtree_root;
-      cur = subtree_root -> right;
-      while(cur -> left != nullptr)
+      count_op(&AVLAtomicOpCounters::node_visits);
+      if(compare_keys(k1, cur -> key) <= 0)
       {
-        prev = cur;
+        stack[depth++] = cur;
         cur = cur -> left;
-      }
+      } else
+        cur = cur -> right;
+    }
+    if(depth == 0)
+      return;
+    cur = stack[--depth];
+    if(compare_keys(k2, cur -> key) < 0)
+      return;
+    visit(cur -> key, cur -> value);
+    cur = cur -> right;
+  }
+}
 
-      // checks if height of previous subtree_root will change after removal
-      if(prev -> right == nullptr)
-        prev -> height--;
-
-      // replaces subtree_root with inorder successor
-      if(prev != subtree_root)
-        prev -> left = cur -> right;
-      cur -> left = subtree_root -> left;
-      if(subtree_root -> right != cur)
-        cur -> right = subtree_root -> right;
-      delete subtree_root;
-      subtree_root = cur;
-
-      // reassign new height
-      subtree_root -> height = tmpHeight;
-      prev = nullptr;
-      cur = nullptr;
-
-      // if subtree_root only has one child
-    } else {
-      if(subtree_root -> left != nullptr)
-      {
-        subtree_root -> height = subtree_root -> left -> height;
-        subtree_root = subtree_root -> left;
-        delete cur;
-      } else {
-        subtree_root -> height = subtree_root -> right -> height;
-        subtree_root = subtree_root -> right;
-        delete cur;
-      }
+
+// copies a subtree node for node with an explicit stack of (source,
+// copy) pairs, so the copy has the same shape and heights as the
+// source and deep trees cannot overflow the call stack
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::clone(const Node* subtree_root_src)
+{
+  if(subtree_root_src == nullptr)
+    return nullptr;
+
+  Node* subtree_root_dst = copy_node(subtree_root_src);
+  std::vector<std::pair<const Node*, Node*>> pending;
+  pending.push_back(std::make_pair(subtree_root_src, subtree_root_dst));
+  while(!pending.empty())
+  {
+    const Node* src = pending.back().first;
+    Node* dst = pending.back().second;
+    pending.pop_back();
+    if(src -> left != nullptr)
+    {
+      dst -> left = copy_node(src -> left);
+      pending.push_back(std::make_pair(src -> left, dst -> left));
+    }
+    if(src -> right != nullptr)
+    {
+      dst -> right = copy_node(src -> right);
+      pending.push_back(std::make_pair(src -> right, dst -> right));
     }
-    tree_size--;
   }
-  // final rebalance
+  return subtree_root_dst;
+}
+
+
+// passes the key through if the comparison can take it as is,
+// otherwise builds a K from it
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+decltype(auto) AVLCollection<K,V,Compare,Alloc,Stats>::lookup_key(const KeyLike& search_key)
+{
+  if constexpr (transparent || std::is_same<KeyLike, K>::value)
+    return (search_key);
+  else
+    return K(search_key);
+}
+
+
+// standard binary search descent, one comparison per level
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+const typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::find_node(const KeyLike& search_key) const
+{
+  const Node* cur = root;
+  while(cur != nullptr)
+  {
+    count_op(&AVLAtomicOpCounters::node_visits);
+    auto order = compare_keys(search_key, cur -> key);
+    if(order < 0)
+      cur = cur -> left;
+    else if(order > 0)
+      cur = cur -> right;
+    else
+      return cur;
+  }
+  return nullptr;
+}
+
+
+// counts keys < search_key (or <= search_key if inclusive) in one descent
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+int AVLCollection<K,V,Compare,Alloc,Stats>::count_less(const KeyLike& search_key, bool inclusive) const
+{
+  static_assert(std::is_same<Stats, OrderStatistics>::value,
+                "rank and count_range require the OrderStatistics policy");
+  int count = 0;
+  const Node* cur = root;
+  while(cur != nullptr)
+  {
+    count_op(&AVLAtomicOpCounters::node_visits);
+    auto order = compare_keys(search_key, cur -> key);
+    bool go_right = inclusive ? order >= 0 : order > 0;
+    if(go_right)
+    {
+      count += NodeStats::size_of(cur -> left) + 1;
+      cur = cur -> right;
+    } else
+      cur = cur -> left;
+  }
+  return count;
+}
+
+
+// issues a prefetch where the compiler supports it
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::prefetch(const Node* node)
+{
+#if defined(__GNUC__)
+  __builtin_prefetch(node);
+#endif
+}
+
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::count_op(std::atomic<long> AVLAtomicOpCounters::* counter) const
+{
+#ifdef AVL_COUNTERS
+  (op_counters.*counter).fetch_add(1, std::memory_order_relaxed);
+#endif
+}
+
+
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename A, typename B>
+auto AVLCollection<K,V,Compare,Alloc,Stats>::compare_keys(const A& lhs, const B& rhs) const
+{
+  count_op(&AVLAtomicOpCounters::comparisons);
+  return compare(lhs, rhs);
+}
+
+
+// copies a node's pair, height and policy data (but not its links)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::copy_node(const Node* src)
+{
+  Node* dst = create_node(src -> key, src -> value);
+  dst -> height = src -> height;
+  static_cast<NodeStats&>(*dst) = *src;
+  return dst;
+}
+
+
+// returns the height of a subtree (0 for an empty subtree)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+int AVLCollection<K,V,Compare,Alloc,Stats>::node_height(const Node* subtree_root)
+{
+  if(subtree_root == nullptr)
+    return 0;
+  return subtree_root -> height;
+}
+
+
+// recomputes a node's height (and subtree size, if kept) from its
+// children
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::update_height(Node* subtree_root)
+{
+  int heightL = node_height(subtree_root -> left);
+  int heightR = node_height(subtree_root -> right);
+  subtree_root -> height = 1 + std::max(heightL, heightR);
+  subtree_root -> update(subtree_root -> left, subtree_root -> right);
+}
+
+
+// rotates nodes right, used for rebalancing
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::rotate_right(Node* k2)
+{
+  Node * k1 = k2 -> left;
+  k2 -> left = k1 -> right;
+  k1 -> right = k2;
+  update_height(k2);
+  update_height(k1);
+  return k1;
+}
+
+
+// rotates nodes left, used for rebalancing
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::rotate_left(Node* k2)
+{
+  Node * k1 = k2 -> right;
+  k2 -> right = k1 -> left;
+  k1 -> left = k2;
+  update_height(k2);
+  update_height(k1);
+  return k1;
+}
+
+
+// rebalances the tree using rotate left and right operations, the
+// children of subtree_root must already have correct heights
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::rebalance(Node* subtree_root)
+{
+  if(!subtree_root)
+    return subtree_root;
+
+  Node* lptr = subtree_root -> left;
+  Node* rptr = subtree_root -> right;
+
+  // obtain left and right subtree heights
+  int heightL = node_height(lptr);
+  int heightR = node_height(rptr);
+
+  // if left heavy (balance is greater than 1)
+  if(heightL - heightR > 1)
+  {
+    // if left-right heavy, double rotate
+    bool inner = node_height(lptr -> left) < node_height(lptr -> right);
+    if(inner)
+      subtree_root -> left = rotate_left(lptr);
+    subtree_root = rotate_right(subtree_root);
+    count_op(inner ? &AVLAtomicOpCounters::double_rotations : &AVLAtomicOpCounters::single_rotations);
+
+    // if right heavy (balance is less than -1)
+  } else if(heightL - heightR < -1)
+  {
+    // if right-left heavy, double rotate
+    bool inner = node_height(rptr -> left) > node_height(rptr -> right);
+    if(inner)
+      subtree_root -> right = rotate_right(rptr);
+    subtree_root = rotate_left(subtree_root);
+    count_op(inner ? &AVLAtomicOpCounters::double_rotations : &AVLAtomicOpCounters::single_rotations);
+  } else
+    update_height(subtree_root);
+  return subtree_root;
+}
+
+
+// adds a key-value pair to the collection
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::add(Node* subtree_root, const K& a_key, const V& a_val)
+{
+  // if spot is open / null
+  if(!subtree_root)
+  {
+    tree_size++;
+    return create_node(a_key, a_val);
+  }
+  count_op(&AVLAtomicOpCounters::node_visits);
+  if(compare_keys(a_key, subtree_root -> key) < 0)
+    subtree_root -> left = add(subtree_root -> left, a_key, a_val);
+  else
+    subtree_root -> right = add(subtree_root -> right, a_key, a_val);
+
+  // rebalance (and fix the height) after insertion
+  return rebalance(subtree_root);
+}
+
+
+// builds a subtree from the next n pairs: the left half becomes the
+// left subtree, the middle pair the root, and the rest the right
+// subtree, so heights can be set bottom-up
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename Iter>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::build_sorted(Iter& next, int n)
+{
+  if(n == 0)
+    return nullptr;
+  Node* left = build_sorted(next, n / 2);
+  Node* subtree_root = create_node(next -> first, next -> second);
+  ++next;
+  subtree_root -> left = left;
+  subtree_root -> right = build_sorted(next, n - n / 2 - 1);
+  update_height(subtree_root);
+  return subtree_root;
+}
+
+
+// unlinks the smallest node of a non-empty subtree, rebalancing on the
+// way back up, and hands it back through min_node
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::remove_min(Node* subtree_root, Node*& min_node)
+{
+  count_op(&AVLAtomicOpCounters::node_visits);
+  if(subtree_root -> left == nullptr)
+  {
+    min_node = subtree_root;
+    return subtree_root -> right;
+  }
+  subtree_root -> left = remove_min(subtree_root -> left, min_node);
+  return rebalance(subtree_root);
+}
+
+
+// unlinks the node holding key in a single descent and hands it back
+// through removed (nullptr if the key isn't in the collection)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename KeyLike>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::remove(const KeyLike& key, Node* subtree_root, Node*& removed)
+{
+  if(subtree_root == nullptr)
+    return subtree_root;
+
+  count_op(&AVLAtomicOpCounters::node_visits);
+  auto order = compare_keys(key, subtree_root -> key);
+  if(order < 0)
+    subtree_root -> left = remove(key, subtree_root -> left, removed);
+  else if(order > 0)
+    subtree_root -> right = remove(key, subtree_root -> right, removed);
+  else {
+    removed = subtree_root;
+
+    // zero or one child: the child takes the node's place
+    if(subtree_root -> left == nullptr)
+      return subtree_root -> right;
+    if(subtree_root -> right == nullptr)
+      return subtree_root -> left;
+
+    // two children: the inorder successor takes the node's place
+    Node* successor = nullptr;
+    Node* rest = remove_min(subtree_root -> right, successor);
+    successor -> left = subtree_root -> left;
+    successor -> right = rest;
+    subtree_root = successor;
+  }
+
+  // nothing below changed if the key wasn't found
+  if(removed == nullptr)
+    return subtree_root;
+
+  // rebalances as it backtracks
   return rebalance(subtree_root);
 }
 
 
-// prints tree using preorder traversal method
-template<typename K, typename V>
-void AVLCollection<K,V>::print_tree(std::string indent, Node* subtree_root)
+//------------------------------------------------------------------------------
+// Set Operation Helpers
+//------------------------------------------------------------------------------
+
+
+// descends the inner spine of the taller tree to a subtree no more than
+// one level higher than the shorter one, hangs the middle node there
+// and rebalances on the way back up
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::join_nodes(Node* left, Node* middle, Node* right)
+{
+  int heightL = node_height(left);
+  int heightR = node_height(right);
+  if(heightL > heightR + 1)
+  {
+    left -> right = join_nodes(left -> right, middle, right);
+    return rebalance(left);
+  }
+  if(heightR > heightL + 1)
+  {
+    right -> left = join_nodes(left, middle, right -> left);
+    return rebalance(right);
+  }
+  middle -> left = left;
+  middle -> right = right;
+  update_height(middle);
+  return middle;
+}
+
+
+// the smallest node of right becomes the middle node
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::join_nodes(Node* left, Node* right)
 {
-  if (!subtree_root)
+  if(right == nullptr)
+    return left;
+  Node* middle = nullptr;
+  right = remove_min(right, middle);
+  return join_nodes(left, middle, right);
+}
+
+
+// splits the child on the key's side and joins the other child back
+// to the node, so each level costs one join
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::split_nodes(Node* subtree_root, const K& key,
+                                                    Node*& left, Node*& right)
+{
+  if(subtree_root == nullptr)
+  {
+    left = right = nullptr;
+    return nullptr;
+  }
+  Node* lptr = subtree_root -> left;
+  Node* rptr = subtree_root -> right;
+  count_op(&AVLAtomicOpCounters::node_visits);
+  auto order = compare_keys(key, subtree_root -> key);
+  if(order == 0)
+  {
+    left = lptr;
+    right = rptr;
+    return subtree_root;
+  }
+  Node* equal;
+  if(order < 0)
+  {
+    equal = split_nodes(lptr, key, left, lptr);
+    right = join_nodes(lptr, subtree_root, rptr);
+  } else {
+    equal = split_nodes(rptr, key, rptr, right);
+    left = join_nodes(lptr, subtree_root, rptr);
+  }
+  return equal;
+}
+
+
+// splits b by a's root and unites the halves on each side; a's node
+// is kept over an equal one from b
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::union_nodes(Node* a, Node* b, SetWork& work, int forks)
+{
+  if(a == nullptr)
+    return b;
+  if(b == nullptr)
+    return a;
+  Node* b_left;
+  Node* b_right;
+  Node* equal = split_nodes(b, a -> key, b_left, b_right);
+  if(equal != nullptr)
+  {
+    work.dropped.push_back(equal);
+    work.matches++;
+  }
+  Node* left;
+  Node* right;
+  fork_join([&](SetWork& w, int f) { left = union_nodes(a -> left, b_left, w, f); },
+            [&](SetWork& w, int f) { right = union_nodes(a -> right, b_right, w, f); },
+            node_height(a) > parallel_height, work, forks);
+  return join_nodes(left, a, right);
+}
+
+
+// splits b by a's root; a's root stays only if b held its key too
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::intersect_nodes(Node* a, Node* b, SetWork& work, int forks)
+{
+  if(a == nullptr || b == nullptr)
+  {
+    // whatever is left of either input has no match
+    drop_nodes(a, work);
+    drop_nodes(b, work);
+    return nullptr;
+  }
+  Node* b_left;
+  Node* b_right;
+  Node* equal = split_nodes(b, a -> key, b_left, b_right);
+  Node* left;
+  Node* right;
+  fork_join([&](SetWork& w, int f) { left = intersect_nodes(a -> left, b_left, w, f); },
+            [&](SetWork& w, int f) { right = intersect_nodes(a -> right, b_right, w, f); },
+            node_height(a) > parallel_height, work, forks);
+  if(equal == nullptr)
+  {
+    work.dropped.push_back(a);
+    return join_nodes(left, right);
+  }
+  work.dropped.push_back(equal);
+  work.matches++;
+  return join_nodes(left, a, right);
+}
+
+
+// splits a by b's root, so b's nodes are the ones examined and dropped
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::difference_nodes(Node* a, Node* b, SetWork& work, int forks)
+{
+  if(a == nullptr || b == nullptr)
+  {
+    drop_nodes(b, work);
+    return a;
+  }
+  bool large = node_height(a) > parallel_height;
+  Node* a_left;
+  Node* a_right;
+  Node* equal = split_nodes(a, b -> key, a_left, a_right);
+  if(equal != nullptr)
+  {
+    work.dropped.push_back(equal);
+    work.matches++;
+  }
+  work.dropped.push_back(b);
+  Node* left;
+  Node* right;
+  fork_join([&](SetWork& w, int f) { left = difference_nodes(a_left, b -> left, w, f); },
+            [&](SetWork& w, int f) { right = difference_nodes(a_right, b -> right, w, f); },
+            large, work, forks);
+  return join_nodes(left, right);
+}
+
+
+// divides the batch at the subtree root's key, links each part into
+// the child on its side and joins the results around the root (or
+// around the batch's node for the same key)
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::insert_nodes(Node* subtree_root, std::span<Node* const> batch,
+                                                     SetWork& work, int forks)
+{
+  if(batch.empty())
+    return subtree_root;
+  if(subtree_root == nullptr)
+    return link_sorted(batch);
+  auto mid = std::lower_bound(batch.begin(), batch.end(), subtree_root, [this](const Node* lhs, const Node* rhs) {
+    return compare_keys(lhs -> key, rhs -> key) < 0;
+  });
+  bool equal = mid != batch.end() && compare_keys((*mid) -> key, subtree_root -> key) == 0;
+  std::span<Node* const> left_batch(batch.begin(), mid);
+  std::span<Node* const> right_batch(mid + equal, batch.end());
+  Node* left;
+  Node* right;
+  fork_join([&](SetWork& w, int f) { left = insert_nodes(subtree_root -> left, left_batch, w, f); },
+            [&](SetWork& w, int f) { right = insert_nodes(subtree_root -> right, right_batch, w, f); },
+            batch.size() >= parallel_batch, work, forks);
+  if(!equal)
+    return join_nodes(left, subtree_root, right);
+  work.dropped.push_back(subtree_root);
+  work.matches++;
+  return join_nodes(left, *mid, right);
+}
+
+
+// divides the keys at the subtree root's key in the same way, dropping
+// the root if its key is in the batch
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::erase_nodes(Node* subtree_root, std::span<const K> batch,
+                                                    SetWork& work, int forks)
+{
+  if(batch.empty() || subtree_root == nullptr)
+    return subtree_root;
+  auto mid = std::lower_bound(batch.begin(), batch.end(), subtree_root -> key, [this](const K& lhs, const K& rhs) {
+    return compare_keys(lhs, rhs) < 0;
+  });
+  bool equal = mid != batch.end() && compare_keys(*mid, subtree_root -> key) == 0;
+  std::span<const K> left_batch(batch.begin(), mid);
+  std::span<const K> right_batch(mid + equal, batch.end());
+  Node* left;
+  Node* right;
+  fork_join([&](SetWork& w, int f) { left = erase_nodes(subtree_root -> left, left_batch, w, f); },
+            [&](SetWork& w, int f) { right = erase_nodes(subtree_root -> right, right_batch, w, f); },
+            batch.size() >= parallel_batch, work, forks);
+  if(!equal)
+    return join_nodes(left, subtree_root, right);
+  work.dropped.push_back(subtree_root);
+  work.matches++;
+  return join_nodes(left, right);
+}
+
+
+// the middle node becomes the root, so heights can be set bottom-up
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::link_sorted(std::span<Node* const> nodes)
+{
+  if(nodes.empty())
+    return nullptr;
+  std::size_t mid = nodes.size() / 2;
+  Node* subtree_root = nodes[mid];
+  subtree_root -> left = link_sorted(nodes.first(mid));
+  subtree_root -> right = link_sorted(nodes.subspan(mid + 1));
+  update_height(subtree_root);
+  return subtree_root;
+}
+
+
+// the left half runs on a new thread with its own SetWork (merged
+// afterwards) and half the forks; small inputs run in place
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+template<typename LeftOp, typename RightOp>
+void AVLCollection<K,V,Compare,Alloc,Stats>::fork_join(LeftOp left_op, RightOp right_op, bool large,
+                                                       SetWork& work, int forks)
+{
+  if(forks < 2 || !large)
+  {
+    left_op(work, 1);
+    right_op(work, 1);
     return;
+  }
+  SetWork left_work;
+  std::thread worker([&] { left_op(left_work, forks / 2); });
+  right_op(work, forks - forks / 2);
+  worker.join();
+  work.dropped.insert(work.dropped.end(), left_work.dropped.begin(), left_work.dropped.end());
+  work.matches += left_work.matches;
+}
+
+
+// the nodes can be linked in as they are if the allocators share
+// storage; otherwise other's tree is copied and then freed
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+typename AVLCollection<K,V,Compare,Alloc,Stats>::Node*
+AVLCollection<K,V,Compare,Alloc,Stats>::adopt(AVLCollection<K,V,Compare,Alloc,Stats>& other)
+{
+  Node* subtree_root;
+  if(node_alloc == other.node_alloc)
+    subtree_root = other.root;
+  else {
+    subtree_root = clone(other.root);
+    other.make_empty(other.root);
+  }
+  other.root = nullptr;
+  other.tree_size = 0;
+  return subtree_root;
+}
+
+
+// walks the subtree with an explicit stack
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::drop_nodes(Node* subtree_root, SetWork& work)
+{
+  std::vector<Node*> stack;
+  if(subtree_root != nullptr)
+    stack.push_back(subtree_root);
+  while(!stack.empty())
+  {
+    Node* node = stack.back();
+    stack.pop_back();
+    if(node -> left)
+      stack.push_back(node -> left);
+    if(node -> right)
+      stack.push_back(node -> right);
+    work.dropped.push_back(node);
+  }
+}
+
+
+// destroys the dropped nodes once no other thread is using the tree
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::release_dropped(SetWork& work)
+{
+  for(Node* node : work.dropped)
+    destroy_node(node);
+  work.dropped.clear();
+}
 
-  std::cout << indent << subtree_root -> key << " (h="
-            << subtree_root -> height << ")" << std::endl;
-  print_tree(indent + "  ", subtree_root -> left);
-  print_tree(indent + "  ", subtree_root -> right);
+
+// pre-order walks of both subtrees, one node each per step; the first
+// to run out is the smaller
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+int AVLCollection<K,V,Compare,Alloc,Stats>::smaller_size(const Node* a, const Node* b, bool& a_smaller)
+{
+  std::vector<const Node*> a_stack;
+  std::vector<const Node*> b_stack;
+  if(a)
+    a_stack.push_back(a);
+  if(b)
+    b_stack.push_back(b);
+  int count = 0;
+  while(!a_stack.empty() && !b_stack.empty())
+  {
+    for(std::vector<const Node*>* stack : {&a_stack, &b_stack})
+    {
+      const Node* node = stack -> back();
+      stack -> pop_back();
+      if(node -> left)
+        stack -> push_back(node -> left);
+      if(node -> right)
+        stack -> push_back(node -> right);
+    }
+    count++;
+  }
+  a_smaller = a_stack.empty();
+  return count;
+}
+
+
+// prints tree using preorder traversal method, with an explicit stack
+// of (node, depth) pairs
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+void AVLCollection<K,V,Compare,Alloc,Stats>::print_tree(std::string indent, Node* subtree_root)
+{
+  std::vector<std::pair<const Node*, int>> stack;
+  if (subtree_root)
+    stack.push_back(std::make_pair(subtree_root, 0));
+  while (!stack.empty())
+  {
+    const Node* node = stack.back().first;
+    int depth = stack.back().second;
+    stack.pop_back();
+    std::cout << indent << std::string(2 * depth, ' ') << node -> key << " (h="
+              << node -> height << ")" << std::endl;
+    if (node -> right)
+      stack.push_back(std::make_pair(node -> right, depth + 1));
+    if (node -> left)
+      stack.push_back(std::make_pair(node -> left, depth + 1));
+  }
 }
 
 
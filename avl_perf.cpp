@@ -1,14 +1,720 @@
-
 #include <iostream>
+#include <vector>
+#include <optional>
+#include <chrono>
+#include <thread>
+#include <atomic>
 #include "avl_collection.h"
+#include "concurrent_avl_collection.h"
+#include "compact_avl_collection.h"
+#include "frozen_avl_collection.h"
+#include "btree_collection.h"
+#include "mapped_avl_collection.h"
+#include "durable_avl_collection.h"
+#include "fixed_key.h"
+#include "trace_loader.h"
 #include "test_driver.h"
 
 using namespace std;
 
+
+// replays the trace on a fresh tree, timing each op and reading the
+// operation counters around it, then prints the average cost of each
+// op type and the shape of the tree left behind (the counters read
+// zero unless built with AVL_COUNTERS)
+void operation_costs(const string& filename)
+{
+  using namespace std::chrono;
+  Trace trace;
+  if (!trace.load(filename))
+    return;
+  vector<string> ks;
+  for (size_t i = 0; i < trace.key_count(); ++i)
+    ks.emplace_back(trace.key(i));
+
+  const char* names[trace_op_types] = {"Add", "Remove", "Find", "Range", "Sort"};
+  long calls[trace_op_types] = {};
+  double ns[trace_op_types] = {};
+  AVLOpCounters costs[trace_op_types];
+  AVLCollection<string,double> coll;
+  double val;
+  vector<double> vals;
+  vector<string> sorted;
+  for (const TraceOp& op : trace) {
+    vals.clear();
+    sorted.clear();
+    AVLOpCounters before = coll.counters();
+    auto start = high_resolution_clock::now();
+    switch (op.type) {
+    case TraceOpType::add:
+      coll.add(ks[op.key1], op.val);
+      break;
+    case TraceOpType::remove:
+      coll.remove(ks[op.key1]);
+      break;
+    case TraceOpType::find:
+      coll.find(ks[op.key1], val);
+      break;
+    case TraceOpType::range:
+      coll.find(ks[op.key1], ks[op.key2], vals);
+      break;
+    case TraceOpType::sort:
+      coll.sort(sorted);
+      break;
+    }
+    auto end = high_resolution_clock::now();
+    AVLOpCounters after = coll.counters();
+    int t = int(op.type);
+    calls[t]++;
+    ns[t] += duration_cast<nanoseconds>(end - start).count();
+    costs[t].comparisons += after.comparisons - before.comparisons;
+    costs[t].single_rotations += after.single_rotations - before.single_rotations;
+    costs[t].double_rotations += after.double_rotations - before.double_rotations;
+    costs[t].node_visits += after.node_visits - before.node_visits;
+    costs[t].allocations += after.allocations - before.allocations;
+  }
+
+  cout << "OPERATION COSTS (average per call):" << endl;
+  cout << "===================================" << endl << endl;
+  if (!coll.counting)
+    cout << "  (counters are off, configure with -DAVL_COUNTERS=ON)" << endl << endl;
+  for (int t = 0; t < trace_op_types; ++t) {
+    if (calls[t] == 0)
+      continue;
+    double n = calls[t];
+    cout << "  " << names[t] << " Time.........: " << ns[t] / n << " nanoseconds" << endl;
+    if (!coll.counting)
+      continue;
+    cout << "  " << names[t] << " Comparisons..: " << costs[t].comparisons / n << endl;
+    cout << "  " << names[t] << " Node visits..: " << costs[t].node_visits / n << endl;
+    cout << "  " << names[t] << " Rotations....: " << costs[t].single_rotations / n
+         << " single, " << costs[t].double_rotations / n << " double" << endl;
+    cout << "  " << names[t] << " Allocations..: " << costs[t].allocations / n << endl << endl;
+  }
+
+  if (!coll.counting)
+    cout << endl;
+
+  AVLTreeStats shape = coll.stats();
+  cout << "  Size.........: " << shape.size << endl;
+  cout << "  Height.......: " << shape.height << endl;
+  cout << "  Depth........: " << shape.average_depth << " average, "
+       << shape.max_depth << " max" << endl;
+  cout << "  Balance......: " << shape.left_heavy << " left heavy, " << shape.balanced
+       << " even, " << shape.right_heavy << " right heavy" << endl;
+  cout << "  Memory.......: " << shape.memory_bytes << " bytes" << endl << endl;
+}
+
+
+// times range searches that return k pairs for growing k; with pruning
+// the cost per query should grow with k, not with the tree size
+void range_scaling(const AVLCollection<string,double>& coll)
+{
+  using namespace std::chrono;
+  vector<string> ks;
+  coll.sort(ks);
+  cout << "RANGE SCALING:" << endl;
+  cout << "==============" << endl << endl;
+  for (int k = 1; k <= 10000 && k <= int(ks.size()); k *= 10) {
+    int queries = 200000 / k + 10;
+    double total = 0;
+    auto start = high_resolution_clock::now();
+    for (int q = 0; q < queries; ++q) {
+      int first = (q * 7919L) % (ks.size() - k + 1);
+      coll.visit_range(ks[first], ks[first + k - 1],
+                       [&total](const string& key, double val) { total += val; });
+    }
+    auto end = high_resolution_clock::now();
+    double ns = duration_cast<nanoseconds>(end - start).count();
+    cout << "  Range k=" << k << " Average.: " << ns / queries
+         << " nanoseconds (" << ns / queries / k << " per result)" << endl;
+    if (total < 0)
+      cout << total;
+  }
+  cout << endl;
+}
+
+
+// compares one-at-a-time finds against find_batch for the keys of the
+// collection, looked up in a scattered order in batches of 256
+void batch_lookups(const AVLCollection<string,double>& coll)
+{
+  using namespace std::chrono;
+  vector<string> ks;
+  coll.sort(ks);
+  vector<string> lookups;
+  for (size_t i = 0; i < ks.size(); ++i)
+    lookups.push_back(ks[(i * 7919) % ks.size()]);
+  const size_t batch = 256;
+  const int rounds = 10;
+  double sum = 0;
+
+  auto start = high_resolution_clock::now();
+  for (int r = 0; r < rounds; ++r)
+    for (const string& key : lookups) {
+      double val = 0;
+      coll.find(key, val);
+      sum += val;
+    }
+  auto end = high_resolution_clock::now();
+  double scalar_ns = duration_cast<nanoseconds>(end - start).count();
+
+  vector<optional<double>> vals(batch);
+  start = high_resolution_clock::now();
+  for (int r = 0; r < rounds; ++r)
+    for (size_t first = 0; first < lookups.size(); first += batch) {
+      size_t n = min(batch, lookups.size() - first);
+      coll.find_batch(span<const string>(lookups.data() + first, n),
+                      span<optional<double>>(vals.data(), n));
+      sum += *vals[0];
+    }
+  end = high_resolution_clock::now();
+  double batch_ns = duration_cast<nanoseconds>(end - start).count();
+
+  long total = long(rounds) * lookups.size();
+  cout << "BATCHED FIND:" << endl;
+  cout << "=============" << endl << endl;
+  cout << "  Scalar find Average.: " << scalar_ns / total << " nanoseconds" << endl;
+  cout << "  Batch find Average..: " << batch_ns / total << " nanoseconds" << endl;
+  cout << endl;
+  if (sum < 0)
+    cout << sum;
+}
+
+
+// returns the average find time in nanoseconds over several rounds of
+// the given lookups
+template<typename Coll, typename Key>
+double find_time(const Coll& coll, const vector<Key>& lookups)
+{
+  using namespace std::chrono;
+  const int rounds = 10;
+  double sum = 0;
+  auto start = high_resolution_clock::now();
+  for (int r = 0; r < rounds; ++r)
+    for (const Key& key : lookups) {
+      double val = 0;
+      coll.find(key, val);
+      sum += val;
+    }
+  auto end = high_resolution_clock::now();
+  if (sum < 0)
+    cout << sum;
+  return double(duration_cast<nanoseconds>(end - start).count()) / (rounds * lookups.size());
+}
+
+
+// compares finds on the pointer tree against its frozen (Eytzinger
+// layout) copy, for the file's keys and for a tree of 1M int keys
+void frozen_lookups(const AVLCollection<string,double>& coll)
+{
+  vector<string> ks;
+  coll.sort(ks);
+  vector<string> lookups;
+  for (size_t i = 0; i < ks.size(); ++i)
+    lookups.push_back(ks[(i * 7919) % ks.size()]);
+  FrozenAVLCollection<string,double,ThreeWayCompare> frozen = coll.freeze();
+
+  const int n = 1000000;
+  AVLCollection<int,double> big;
+  vector<int> int_lookups;
+  for (int i = 0; i < n; ++i) {
+    int key = int((long(i) * 7919) % n);
+    big.add(key, 1.0);
+    int_lookups.push_back(int((long(i) * 104729) % n));
+  }
+  FrozenAVLCollection<int,double,ThreeWayCompare> big_frozen = big.freeze();
+
+  cout << "FROZEN LAYOUT:" << endl;
+  cout << "==============" << endl << endl;
+  cout << "  string Tree find Average..: " << find_time(coll, lookups) << " nanoseconds" << endl;
+  cout << "  string Frozen find Average: " << find_time(frozen, lookups) << " nanoseconds" << endl;
+  cout << "  1M int Tree find Average..: " << find_time(big, int_lookups) << " nanoseconds" << endl;
+  cout << "  1M int Frozen find Average: " << find_time(big_frozen, int_lookups) << " nanoseconds" << endl;
+  cout << endl;
+}
+
+
+// compares finds on the AVL tree and the wide-node B-tree, for the
+// file's keys as strings and as FixedKey<5> (vector node search only
+// with AVL_NATIVE, since 64-bit lanes need SSE4.2) and for 1M int keys
+// (vector node search)
+void btree_lookups(const AVLCollection<string,double>& coll)
+{
+  vector<string> ks;
+  coll.sort(ks);
+  vector<string> lookups;
+  vector<FixedKey<5>> fixed_lookups;
+  BTreeCollection<string,double> btree;
+  AVLCollection<FixedKey<5>,double> fixed_avl;
+  BTreeCollection<FixedKey<5>,double> fixed_btree;
+  for (size_t i = 0; i < ks.size(); ++i) {
+    const string& key = ks[(i * 7919) % ks.size()];
+    lookups.push_back(key);
+    fixed_lookups.push_back(FixedKey<5>(key));
+    btree.add(key, 1.0);
+    fixed_avl.add(FixedKey<5>(key), 1.0);
+    fixed_btree.add(FixedKey<5>(key), 1.0);
+  }
+
+  const int n = 1000000;
+  AVLCollection<int,double> avl_ints;
+  BTreeCollection<int,double> btree_ints;
+  vector<int> int_lookups;
+  for (int i = 0; i < n; ++i) {
+    int key = int((long(i) * 7919) % n);
+    avl_ints.add(key, 1.0);
+    btree_ints.add(key, 1.0);
+    int_lookups.push_back(int((long(i) * 104729) % n));
+  }
+
+  cout << "B-TREE:" << endl;
+  cout << "=======" << endl << endl;
+  cout << "  string AVL find Average.......: " << find_time(coll, lookups) << " nanoseconds" << endl;
+  cout << "  string B-tree find Average....: " << find_time(btree, lookups) << " nanoseconds" << endl;
+  cout << "  FixedKey<5> AVL find Average..: " << find_time(fixed_avl, fixed_lookups) << " nanoseconds" << endl;
+  cout << "  FixedKey<5> B-tree find Avg...: " << find_time(fixed_btree, fixed_lookups) << " nanoseconds" << endl;
+  cout << "  1M int AVL find Average.......: " << find_time(avl_ints, int_lookups) << " nanoseconds" << endl;
+  cout << "  1M int B-tree find Average....: " << find_time(btree_ints, int_lookups) << " nanoseconds" << endl;
+  cout << endl;
+}
+
+
+// microseconds taken by one call of op
+template<typename Op>
+long time_once(Op op)
+{
+  auto start = chrono::steady_clock::now();
+  op();
+  return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+
+
+// merges a small and an equal-sized set of int keys into a 1M key tree
+// one add at a time and with union_with, then times the other set
+// operations
+void set_operations()
+{
+  const int n = 1000000;
+  auto make = [](int count, int step) {
+    vector<pair<int,double>> kvs;
+    for (int i = 0; i < count; ++i)
+      kvs.push_back(make_pair(i * step, 1.0));
+    return AVLCollection<int,double>(kvs.begin(), kvs.end());
+  };
+
+  cout << "SET OPERATIONS (1M int keys):" << endl;
+  cout << "=============================" << endl << endl;
+  for (int m : {10000, n}) {
+    AVLCollection<int,double> by_add = make(n, 2);
+    AVLCollection<int,double> other = make(m, 3);
+    long add_time = time_once([&] {
+      double v;
+      for (const auto& entry : other)
+        if (!by_add.find(entry.key, v))
+          by_add.add(entry.key, entry.value);
+    });
+    // the other trees have their own allocators, so each operation
+    // first copies the other tree's nodes (O(m))
+    AVLCollection<int,double> by_union = make(n, 2), by_parallel = make(n, 2);
+    AVLCollection<int,double> intersected = make(n, 2), reduced = make(n, 2);
+    vector<AVLCollection<int,double>> others;
+    for (int i = 0; i < 4; ++i)
+      others.push_back(make(m, 3));
+    long union_time = time_once([&] { by_union.union_with(std::move(others[0])); });
+    long parallel_time = time_once([&] { by_parallel.union_with(std::move(others[1]), 4); });
+    long intersect_time = time_once([&] { intersected.intersect_with(std::move(others[2])); });
+    long difference_time = time_once([&] { reduced.difference(std::move(others[3])); });
+    cout << "  m = " << m << endl;
+    cout << "    add each missing key........: " << add_time << " microseconds" << endl;
+    cout << "    union_with..................: " << union_time << " microseconds" << endl;
+    cout << "    union_with, 4 threads.......: " << parallel_time << " microseconds" << endl;
+    cout << "    intersect_with..............: " << intersect_time << " microseconds" << endl;
+    cout << "    difference..................: " << difference_time << " microseconds" << endl;
+  }
+  AVLCollection<int,double> whole = make(n, 1);
+  long split_time = time_once([&] { AVLCollection<int,double> upper = whole.split(n / 3); whole.join(std::move(upper)); });
+  cout << "  split and join back...........: " << split_time << " microseconds" << endl;
+  cout << endl;
+}
+
+
+// inserts and then erases a batch of 200k int keys in a 1M key tree
+// with an add/remove loop and with the batch operations on 1 to 8
+// threads
+void batch_scaling()
+{
+  const int n = 1000000;
+  const int m = 200000;
+  vector<pair<int,double>> base;
+  for (int i = 0; i < n; ++i)
+    base.push_back(make_pair(i * 2, 1.0));
+  vector<pair<int,double>> batch;
+  vector<int> batch_keys;
+  for (int i = 0; i < m; ++i) {
+    int key = int((long(i) * 7919) % m) * 10 + 1;
+    batch.push_back(make_pair(key, 2.0));
+    batch_keys.push_back(key);
+  }
+
+  cout << "BATCH UPDATES (200k keys into 1M, insert / erase):" << endl;
+  cout << "==================================================" << endl << endl;
+  cout << "  hardware threads..: " << thread::hardware_concurrency() << endl;
+  AVLCollection<int,double> looped(base.begin(), base.end());
+  long add_time = time_once([&] {
+    for (const auto& kv : batch)
+      looped.add(kv.first, kv.second);
+  });
+  long remove_time = time_once([&] {
+    for (int key : batch_keys)
+      looped.remove(key);
+  });
+  cout << "  add/remove loop...: " << add_time << " / " << remove_time << " microseconds" << endl;
+  for (int threads : {1, 2, 4, 8}) {
+    AVLCollection<int,double> batched(base.begin(), base.end());
+    long insert_time = time_once([&] { batched.insert_batch(batch, threads); });
+    long erase_time = time_once([&] { batched.erase_batch(batch_keys, threads); });
+    cout << "  " << threads << " thread(s)......: " << insert_time << " / " << erase_time
+         << " microseconds" << endl;
+  }
+  cout << endl;
+}
+
+
+// time the calling thread spends tearing down a 1M string key tree,
+// destroying it in place and handing it to a background thread
+void teardown()
+{
+  const int n = 1000000;
+  auto make = [] {
+    vector<pair<string,double>> kvs;
+    for (int i = 0; i < n; ++i)
+      kvs.push_back(make_pair(to_string(i), 1.0));
+    return AVLCollection<string,double>(kvs.begin(), kvs.end());
+  };
+  cout << "TEARDOWN (1M string keys):" << endl;
+  cout << "==========================" << endl << endl;
+  optional<AVLCollection<string,double>> doomed(make());
+  cout << "  destructor..........: " << time_once([&] { doomed.reset(); }) << " microseconds" << endl;
+  AVLCollection<string,double> coll = make();
+  cout << "  clear_in_background.: " << time_once([&] { coll.clear_in_background(); })
+       << " microseconds" << endl;
+  coll.wait_for_clear();
+  cout << endl;
+}
+
+
+// times reading the trace with fstream >> (as TestDriver does), with
+// the mapped text loader and from a binary trace, then replays the
+// pre-parsed ops
+void trace_loading(const string& filename)
+{
+  long stream_time = time_once([&] {
+    ifstream in_file(filename);
+    string op, key;
+    double val;
+    while (in_file >> op) {
+      if (op == "add")
+        in_file >> key >> val;
+      else if (op == "remove" || op == "find")
+        in_file >> key;
+      else if (op == "range")
+        in_file >> key >> key;
+    }
+  });
+  Trace text;
+  long text_time = time_once([&] { text.load_text(filename); });
+  const string binary_file = "avl_perf_trace.bin";
+  text.save_binary(binary_file);
+  Trace binary;
+  long binary_time = time_once([&] { binary.load_binary(binary_file); });
+
+  vector<string> keys;
+  for (size_t i = 0; i < binary.key_count(); ++i)
+    keys.push_back(string(binary.key(i)));
+  AVLCollection<string,double> coll;
+  vector<double> vals;
+  vector<string> sorted_keys;
+  long replay_time = time_once([&] {
+    double found;
+    for (const TraceOp& op : binary) {
+      if (op.type == TraceOpType::add)
+        coll.add(keys[op.key1], op.val);
+      else if (op.type == TraceOpType::remove)
+        coll.remove(keys[op.key1]);
+      else if (op.type == TraceOpType::find)
+        coll.find(keys[op.key1], found);
+      else if (op.type == TraceOpType::range)
+        coll.find(keys[op.key1], keys[op.key2], vals);
+      else
+        coll.sort(sorted_keys);
+    }
+  });
+  std::remove(binary_file.c_str());
+
+  cout << "TRACE LOADING:" << endl;
+  cout << "==============" << endl << endl;
+  cout << "  ops / distinct keys.: " << binary.size() << " / " << binary.key_count() << endl;
+  cout << "  fstream parse.......: " << stream_time << " microseconds" << endl;
+  cout << "  mapped text parse...: " << text_time << " microseconds" << endl;
+  cout << "  binary trace map....: " << binary_time << " microseconds" << endl;
+  cout << "  pre-parsed replay...: " << replay_time << " microseconds" << endl;
+  cout << endl;
+}
+
+
+// compares the ways of getting the collection back after a restart:
+// replaying every add, loading a saved image into a tree, and mapping
+// the image and searching it in place
+void mapped_image(const AVLCollection<string,double>& coll)
+{
+  using namespace std::chrono;
+  const string file = "avl_perf_image.bin";
+  vector<string> ks;
+  coll.keys(ks);
+  vector<string> lookups;
+  for (size_t i = 0; i < ks.size(); ++i)
+    lookups.push_back(ks[(i * 7919) % ks.size()]);
+
+  auto start = high_resolution_clock::now();
+  save_image(coll, file);
+  auto end = high_resolution_clock::now();
+  double save_us = duration_cast<microseconds>(end - start).count();
+
+  start = high_resolution_clock::now();
+  AVLCollection<string,double> replayed;
+  for (const string& key : lookups)
+    replayed.add(key, 1.0);
+  end = high_resolution_clock::now();
+  double replay_us = duration_cast<microseconds>(end - start).count();
+
+  start = high_resolution_clock::now();
+  AVLCollection<string,double> loaded;
+  load_image(loaded, file);
+  end = high_resolution_clock::now();
+  double load_us = duration_cast<microseconds>(end - start).count();
+
+  start = high_resolution_clock::now();
+  MappedAVLCollection<string,double> mapped(file);
+  end = high_resolution_clock::now();
+  double map_us = duration_cast<microseconds>(end - start).count();
+
+  cout << "MAPPED IMAGE:" << endl;
+  cout << "=============" << endl << endl;
+  cout << "  Save Time...............: " << save_us << " microseconds" << endl;
+  cout << "  Rebuild by add Time.....: " << replay_us << " microseconds" << endl;
+  cout << "  Load Time...............: " << load_us << " microseconds" << endl;
+  cout << "  Map Time................: " << map_us << " microseconds" << endl;
+  cout << "  Tree find Average.......: " << find_time(coll, lookups) << " nanoseconds" << endl;
+  cout << "  Mapped find Average.....: " << find_time(mapped, lookups) << " nanoseconds" << endl;
+  cout << endl;
+  std::remove(file.c_str());
+}
+
+
+// replays the file through TestDriver and returns the wall-clock time
+// of the whole run in microseconds
+double replay_time(const string& filename, Collection<string,double>* coll)
+{
+  using namespace std::chrono;
+  TestDriver<string,double> driver(filename, coll);
+  auto start = high_resolution_clock::now();
+  driver.run_tests();
+  auto end = high_resolution_clock::now();
+  return duration_cast<microseconds>(end - start).count();
+}
+
+
+// replays the file on a durable collection with the given options and
+// prints the run time and the number of log syncs
+void durable_replay(const string& filename, const string& label, int batch_size,
+                    int sync_interval_ms, long checkpoint_records)
+{
+  const string base = "avl_perf_durable";
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+  DurableOptions options;
+  options.batch_size = batch_size;
+  options.sync_interval = std::chrono::milliseconds(sync_interval_ms);
+  options.checkpoint_records = checkpoint_records;
+  {
+    DurableAVLCollection<string,double> coll(base, options);
+    double us = replay_time(filename, &coll);
+    coll.sync();
+    cout << "  " << label << long(us) << " microseconds, "
+         << coll.log_syncs() << " syncs" << endl;
+  }
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+}
+
+
+// compares a plain in-memory replay of the file against durable
+// replays with different batch sizes, sync intervals and checkpoints;
+// syncing every update costs one fdatasync per op (minutes on a
+// spinning disk), so that run is only done when asked for
+void durability(const string& filename, bool sync_every_update)
+{
+  AVLCollection<string,double> memory;
+  cout << "DURABILITY (replay time):" << endl;
+  cout << "=========================" << endl << endl;
+  cout << "  In memory only.................: "
+       << long(replay_time(filename, &memory)) << " microseconds" << endl;
+  if (sync_every_update)
+    durable_replay(filename, "Batch 1 (sync every update)....: ", 1, 0, 0);
+  durable_replay(filename, "Batch 64, 1 ms.................: ", 64, 1, 0);
+  durable_replay(filename, "Batch 1024, 10 ms..............: ", 1024, 10, 0);
+  durable_replay(filename, "Batch 1024, 10 ms, ckpt 10000..: ", 1024, 10, 10000);
+  cout << endl;
+}
+
+
+// builds a tree from the given keys and then looks each key up,
+// returning the average add and find times in nanoseconds
+template<typename Key>
+pair<double,double> add_find_times(const vector<string>& ks)
+{
+  using namespace std::chrono;
+  vector<Key> keys;
+  for (size_t i = 0; i < ks.size(); ++i)
+    keys.push_back(Key(ks[(i * 7919) % ks.size()]));
+  AVLCollection<Key,double> coll;
+  auto start = high_resolution_clock::now();
+  for (const Key& key : keys)
+    coll.add(key, 1.0);
+  auto end = high_resolution_clock::now();
+  double add_ns = duration_cast<nanoseconds>(end - start).count();
+  double sum = 0;
+  const int rounds = 10;
+  start = high_resolution_clock::now();
+  for (int r = 0; r < rounds; ++r)
+    for (const Key& key : keys) {
+      double val = 0;
+      coll.find(key, val);
+      sum += val;
+    }
+  end = high_resolution_clock::now();
+  double find_ns = duration_cast<nanoseconds>(end - start).count();
+  if (sum < 0)
+    cout << sum;
+  return make_pair(add_ns / keys.size(), find_ns / (rounds * keys.size()));
+}
+
+
+// compares std::string keys against inline FixedKey<5> keys (all the
+// keys in the rand-*.txt files are 5 characters)
+void fixed_keys(const AVLCollection<string,double>& coll)
+{
+  vector<string> ks;
+  coll.sort(ks);
+  pair<double,double> before = add_find_times<string>(ks);
+  pair<double,double> after = add_find_times<FixedKey<5>>(ks);
+  cout << "FIXED-WIDTH KEYS:" << endl;
+  cout << "=================" << endl << endl;
+  cout << "  string Add Average......: " << before.first << " nanoseconds" << endl;
+  cout << "  string Find Average.....: " << before.second << " nanoseconds" << endl;
+  cout << "  FixedKey<5> Add Average.: " << after.first << " nanoseconds" << endl;
+  cout << "  FixedKey<5> Find Average: " << after.second << " nanoseconds" << endl;
+  cout << endl;
+}
+
+
+// fills a collection with every key and returns its bytes per entry
+template<typename Coll, typename Key>
+double bytes_per_entry(const vector<string>& ks)
+{
+  Coll coll;
+  for (const string& k : ks)
+    coll.add(Key(k), 1.0);
+  return double(coll.memory_bytes()) / coll.size();
+}
+
+
+// compares the memory used per entry by the pointer-linked node layout
+// and the compact (index-linked, one-byte height) layout
+void memory_usage(const AVLCollection<string,double>& coll)
+{
+  vector<string> ks;
+  coll.keys(ks);
+  typedef FixedKey<5> Key5;
+  cout << "MEMORY USAGE (bytes per entry):" << endl;
+  cout << "===============================" << endl << endl;
+  cout << "  string AVL..............: "
+       << bytes_per_entry<AVLCollection<string,double>,string>(ks) << endl;
+  cout << "  string Compact AVL......: "
+       << bytes_per_entry<CompactAVLCollection<string,double>,string>(ks) << endl;
+  cout << "  FixedKey<5> AVL.........: "
+       << bytes_per_entry<AVLCollection<Key5,double>,Key5>(ks) << endl;
+  cout << "  FixedKey<5> Compact AVL.: "
+       << bytes_per_entry<CompactAVLCollection<Key5,double>,Key5>(ks) << endl;
+  cout << endl;
+}
+
+
+// runs finds from several reader threads at once (optionally next to
+// one writer that keeps adding and removing a key) and returns the
+// total number of finds per second
+template<typename Coll>
+double read_throughput(Coll& coll, const vector<string>& ks, int readers, bool writer)
+{
+  using namespace std::chrono;
+  const int finds = 200000;
+  atomic<bool> done(false);
+  thread writer_thread;
+  if (writer)
+    writer_thread = thread([&coll, &done]() {
+      while (!done) {
+        coll.add("~~~~~", 0);
+        coll.remove("~~~~~");
+      }
+    });
+  vector<thread> threads;
+  auto start = high_resolution_clock::now();
+  for (int t = 0; t < readers; ++t)
+    threads.push_back(thread([&coll, &ks, t]() {
+      double val;
+      for (int i = 0; i < finds; ++i)
+        coll.find(ks[(i * 7919L + t) % ks.size()], val);
+    }));
+  for (thread& t : threads)
+    t.join();
+  auto end = high_resolution_clock::now();
+  done = true;
+  if (writer)
+    writer_thread.join();
+  double secs = duration_cast<nanoseconds>(end - start).count() / 1e9;
+  return readers * finds / secs;
+}
+
+
+// prints read throughput of the thread-safe wrappers for 1, 2, 4, ...
+// reader threads
+void concurrent_reads(const AVLCollection<string,double>& coll)
+{
+  vector<string> ks;
+  coll.sort(ks);
+  SharedAVLCollection<string,double> shared(coll);
+  SnapshotAVLCollection<string,double> snapshots(coll);
+  int max_readers = max(4u, thread::hardware_concurrency());
+  cout << "CONCURRENT READS (finds/second):" << endl;
+  cout << "================================" << endl << endl;
+  for (int readers = 1; readers <= max_readers; readers *= 2) {
+    cout << "  Readers=" << readers << " Shared......: "
+         << read_throughput(shared, ks, readers, false) << endl;
+    cout << "  Readers=" << readers << " Shared+1W...: "
+         << read_throughput(shared, ks, readers, true) << endl;
+    cout << "  Readers=" << readers << " Snapshot+1W.: "
+         << read_throughput(snapshots, ks, readers, true) << endl;
+  }
+  cout << endl;
+}
+
+
 int main(int argc, char** argv)
 {
-  if (argc != 2) {
-    cout << "usage: " << argv[0] << " filename" << endl;
+  bool sync_every_update = argc == 3 && string(argv[2]) == "--sync-every-update";
+  if (argc != 2 && !sync_every_update) {
+    cout << "usage: " << argv[0] << " filename [--sync-every-update]" << endl;
     return 1;
   }
   
@@ -18,4 +724,39 @@ int main(int argc, char** argv)
   driver.run_tests();
   driver.print_results();
   cout << "  Tree height..: " << test_collection.height() << endl << endl;
+
+  // replay the same file on the wide-node b-tree
+  BTreeCollection<string,double> btree_collection;
+  TestDriver<string,double> btree_driver(argv[1], &btree_collection);
+  btree_driver.run_tests();
+  cout << "B-tree replay:" << endl << endl;
+  btree_driver.print_results();
+  cout << "  Tree height..: " << btree_collection.height() << endl << endl;
+
+  // replay the same file with one heap allocation per node to compare
+  // against the slab allocator
+  AVLCollection<string,double,ThreeWayCompare,NewDeleteAllocator> heap_collection;
+  TestDriver<string,double> heap_driver(argv[1], &heap_collection);
+  heap_driver.run_tests();
+  cout << "  Node allocations.........: "
+       << test_collection.node_allocations() << endl;
+  cout << "  Heap allocations (before): "
+       << heap_collection.heap_allocations() << " (new/delete per node)" << endl;
+  cout << "  Heap allocations (after).: "
+       << test_collection.heap_allocations() << " (slab allocator)" << endl << endl;
+
+  operation_costs(argv[1]);
+  range_scaling(test_collection);
+  batch_lookups(test_collection);
+  frozen_lookups(test_collection);
+  btree_lookups(test_collection);
+  set_operations();
+  batch_scaling();
+  teardown();
+  mapped_image(test_collection);
+  durability(argv[1], sync_every_update);
+  trace_loading(argv[1]);
+  fixed_keys(test_collection);
+  memory_usage(test_collection);
+  concurrent_reads(test_collection);
 }
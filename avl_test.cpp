@@ -10,8 +10,27 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <sstream>
+#include <set>
+#include <map>
 #include <gtest/gtest.h>
+#include <thread>
+#include <csignal>
+#include <sys/resource.h>
 #include "avl_collection.h"
+#include "concurrent_avl_collection.h"
+#include "persistent_avl_collection.h"
+#include "compact_avl_collection.h"
+#include "frozen_avl_collection.h"
+#include "btree_collection.h"
+#include "mapped_avl_collection.h"
+#include "durable_avl_collection.h"
+#include "fixed_key.h"
+#include "trace_loader.h"
+#include "workload_generator.h"
+#include "std_collections.h"
+#include "bench_harness.h"
 
 using namespace std;
 
@@ -315,6 +334,1365 @@ TEST(NewTest, HeightUpdateCheck)
   ASSERT_EQ(0, w.size());
 }
 
+
+TEST(NewTest, RemoveReturnValue)
+{
+  AVLCollection<string,int> c;
+  c.add("b", 20);
+  c.add("a", 10);
+  c.add("c", 30);
+  int v = 0;
+  ASSERT_EQ(true, c.remove("a"));
+  ASSERT_EQ(false, c.remove("a"));
+  ASSERT_EQ(true, c.remove("c", v));
+  ASSERT_EQ(30, v);
+  ASSERT_EQ(false, c.remove("z", v));
+  ASSERT_EQ(30, v);
+  ASSERT_EQ(1, c.size());
+}
+
+
+TEST(NewTest, RandomRemoveKeepsBalance)
+{
+  AVLCollection<int,int> c;
+  // 7919 is prime, so i * 31 % 7919 visits every key once
+  for(int i = 0; i < 7919; ++i)
+    c.add(i * 31 % 7919, i);
+  for(int i = 0; i < 7919; i += 2)
+    ASSERT_EQ(true, c.remove(i * 17 % 7919));
+  ASSERT_EQ(3959, c.size());
+  // an AVL tree with n nodes is at most 1.44 log2(n) high
+  ASSERT_LE(c.height(), 17);
+  vector<int> ks;
+  c.sort(ks);
+  ASSERT_EQ(3959, ks.size());
+  for(int i = 0; i < int(ks.size()) - 1; ++i)
+    ASSERT_LT(ks[i], ks[i+1]);
+  int v;
+  for(int i = 1; i < 7919; i += 2)
+    ASSERT_EQ(true, c.find(i * 17 % 7919, v));
+}
+
+
+TEST(NewTest, CopyKeepsShape)
+{
+  AVLCollection<int,int> c1;
+  for(int i = 0; i < 1000; ++i)
+    c1.add(i * 37 % 1000, i);
+  AVLCollection<int,int> c2(c1);
+  ASSERT_EQ(c1.size(), c2.size());
+  ASSERT_EQ(c1.height(), c2.height());
+  // copies are independent
+  c2.remove(5);
+  int v;
+  ASSERT_EQ(true, c1.find(5, v));
+  ASSERT_EQ(false, c2.find(5, v));
+  // a copy takes one node allocation per node, no more
+  ASSERT_EQ(1000, c2.node_allocations());
+  c1 = c2;
+  ASSERT_EQ(999, c1.size());
+  ASSERT_EQ(false, c1.find(5, v));
+}
+
+
+TEST(NewTest, MoveLeavesSourceEmpty)
+{
+  AVLCollection<string,int> c1;
+  c1.add("b", 20);
+  c1.add("a", 10);
+  c1.add("c", 30);
+  AVLCollection<string,int> c2(std::move(c1));
+  ASSERT_EQ(3, c2.size());
+  ASSERT_EQ(2, c2.height());
+  ASSERT_EQ(0, c1.size());
+  ASSERT_EQ(0, c1.height());
+  // the moved-from tree is still usable
+  c1.add("z", 1);
+  ASSERT_EQ(1, c1.size());
+  c1 = std::move(c2);
+  ASSERT_EQ(3, c1.size());
+  ASSERT_EQ(0, c2.size());
+  int v;
+  ASSERT_EQ(false, c1.find("z", v));
+  ASSERT_EQ(true, c1.find("c", v));
+  ASSERT_EQ(30, v);
+}
+
+
+TEST(RangeTest, RangeInKeyOrder)
+{
+  AVLCollection<int,int> c;
+  for(int i = 0; i < 1000; ++i)
+    c.add(i * 7 % 1000, i * 7 % 1000);
+  vector<int> vs;
+  c.find(100, 199, vs);
+  ASSERT_EQ(100, vs.size());
+  for(int i = 0; i < 100; ++i)
+    ASSERT_EQ(100 + i, vs[i]);
+  vs.clear();
+  c.find(-5, 2, vs);
+  ASSERT_EQ(3, vs.size());
+  vs.clear();
+  c.find(998, 2000, vs);
+  ASSERT_EQ(2, vs.size());
+  vs.clear();
+  c.find(600, 500, vs);
+  ASSERT_EQ(0, vs.size());
+}
+
+
+TEST(RangeTest, VisitRange)
+{
+  AVLCollection<string,int> c;
+  c.add("c", 30);
+  c.add("a", 10);
+  c.add("e", 50);
+  c.add("b", 20);
+  c.add("d", 40);
+  int total = 0;
+  string ks;
+  c.visit_range("b", "d", [&](const string& k, int v) { ks += k; total += v; });
+  ASSERT_EQ("bcd", ks);
+  ASSERT_EQ(90, total);
+}
+
+
+TEST(NewTest, FindBatch)
+{
+  AVLCollection<int,int> c;
+  for(int i = 0; i < 1000; ++i)
+    c.add(i * 7 % 1000 * 2, i);
+  // a mix of present (even) and missing (odd) keys, more than one group
+  vector<int> ks;
+  for(int i = 0; i < 100; ++i)
+    ks.push_back(i * 13 % 2002);
+  vector<optional<int>> vs(ks.size(), 42);
+  c.find_batch(ks, vs);
+  for(size_t i = 0; i < ks.size(); ++i)
+  {
+    int v;
+    if(c.find(ks[i], v))
+      ASSERT_EQ(v, vs[i].value());
+    else
+      ASSERT_EQ(false, vs[i].has_value());
+  }
+  AVLCollection<int,int> empty;
+  empty.find_batch(ks, vs);
+  ASSERT_EQ(false, vs[0].has_value());
+}
+
+
+TEST(CompareTest, HeterogeneousLookup)
+{
+  AVLCollection<string,int> c;
+  c.add("apple", 1);
+  c.add("banana", 2);
+  c.add("cherry", 3);
+  c.add("date", 4);
+  int v;
+  string_view sv("banana");
+  ASSERT_EQ(true, c.find(sv, v));
+  ASSERT_EQ(2, v);
+  const char* cs = "cherry";
+  ASSERT_EQ(true, c.find(cs, v));
+  ASSERT_EQ(3, v);
+  ASSERT_EQ(false, c.find(string_view("fig"), v));
+  ASSERT_EQ("cherry", c.lower_bound(string_view("c")) -> key);
+  vector<int> vs;
+  c.find(string_view("b"), string_view("d"), vs);
+  ASSERT_EQ(2, vs.size());
+  ASSERT_EQ(true, c.remove(string_view("apple")));
+  ASSERT_EQ(false, c.remove(string_view("apple")));
+  ASSERT_EQ(true, c.remove(cs, v));
+  ASSERT_EQ(3, v);
+  ASSERT_EQ(2, c.size());
+}
+
+
+// non-transparent comparison giving descending order
+struct Descending
+{
+  int operator()(const int& lhs, const int& rhs) const
+  {
+    return rhs - lhs;
+  }
+};
+
+
+TEST(CompareTest, CustomComparator)
+{
+  AVLCollection<int,string,Descending> c;
+  c.add(10, "a");
+  c.add(30, "c");
+  c.add(20, "b");
+  c.add(40, "d");
+  vector<int> ks;
+  c.sort(ks);
+  ASSERT_EQ(40, ks[0]);
+  ASSERT_EQ(10, ks[3]);
+  string v;
+  // a short is converted to the key type once
+  ASSERT_EQ(true, c.find(short(20), v));
+  ASSERT_EQ("b", v);
+  ASSERT_EQ(20, c.lower_bound(25) -> key);
+  vector<string> vs;
+  c.find(35, 15, vs);
+  ASSERT_EQ(2, vs.size());
+  ASSERT_EQ("c", vs[0]);
+  ASSERT_EQ(true, c.remove(30));
+  ASSERT_EQ(3, c.size());
+}
+
+
+TEST(FixedKeyTest, OrdersLikeStrings)
+{
+  vector<string> words = {"BJPKZ", "AAAAB", "AAAAA", "ZZZZZ", "EXJTM", "A", "", "AB", "GRNLZ"};
+  for(const string& a : words)
+    for(const string& b : words)
+    {
+      ASSERT_EQ(a < b, FixedKey<5>(a) < FixedKey<5>(b));
+      ASSERT_EQ(a == b, FixedKey<5>(a) == FixedKey<5>(b));
+    }
+  // keys longer than one word
+  ASSERT_LT(FixedKey<12>("ABCDEFGHIJ"), FixedKey<12>("ABCDEFGHIK"));
+  ASSERT_EQ("ABCDEFGHIJ", FixedKey<12>("ABCDEFGHIJ").str());
+  // longer strings are cut to N characters
+  ASSERT_EQ("ABC", FixedKey<3>("ABCDE").str());
+}
+
+
+TEST(FixedKeyTest, Collection)
+{
+  FixedKeyAVLCollection<5,double> c;
+  c.add("GRNLZ", 3.03);
+  c.add("AAAAA", 12.60);
+  c.add("EXJTM", 8.36);
+  c.add("BJPKZ", 14.89);
+  double v;
+  ASSERT_EQ(true, c.find("EXJTM", v));
+  ASSERT_EQ(8.36, v);
+  ASSERT_EQ(false, c.find(FixedKey<5>("EXJTN"), v));
+  vector<FixedKey<5>> ks;
+  c.sort(ks);
+  ASSERT_EQ("AAAAA", ks[0].str());
+  ASSERT_EQ("GRNLZ", ks[3].str());
+  vector<double> vs;
+  c.find("B", "F", vs);
+  ASSERT_EQ(2, vs.size());
+  ASSERT_EQ(true, c.remove("AAAAA"));
+  ASSERT_EQ(3, c.size());
+}
+
+
+TEST(IteratorTest, ForwardAndBackward)
+{
+  AVLCollection<int,int> c;
+  ASSERT_EQ(c.begin(), c.end());
+  for(int i = 0; i < 500; ++i)
+    c.add(i * 7 % 500, i);
+  int expected = 0;
+  for(AVLCollection<int,int>::const_iterator it = c.begin(); it != c.end(); ++it)
+  {
+    ASSERT_EQ(expected, it -> key);
+    ++expected;
+  }
+  ASSERT_EQ(500, expected);
+  AVLCollection<int,int>::const_iterator it = c.end();
+  for(int i = 499; i >= 0; --i)
+  {
+    --it;
+    ASSERT_EQ(i, (*it).key);
+  }
+  ASSERT_EQ(c.begin(), it);
+}
+
+
+TEST(IteratorTest, Bounds)
+{
+  AVLCollection<int,string> c;
+  c.add(50, "e");
+  c.add(10, "a");
+  c.add(30, "c");
+  c.add(40, "d");
+  c.add(60, "f");
+  c.add(20, "b");
+  ASSERT_EQ(30, c.lower_bound(30) -> key);
+  ASSERT_EQ(40, c.upper_bound(30) -> key);
+  ASSERT_EQ(30, c.lower_bound(25) -> key);
+  ASSERT_EQ(30, c.upper_bound(25) -> key);
+  ASSERT_EQ(10, c.lower_bound(0) -> key);
+  ASSERT_EQ(c.end(), c.lower_bound(61));
+  ASSERT_EQ(c.end(), c.upper_bound(60));
+  ASSERT_EQ(60, (--c.upper_bound(60)) -> key);
+  // stream a range and stop early
+  vector<string> vs;
+  for(auto it = c.lower_bound(20); it != c.end() && it -> key <= 50; ++it)
+    vs.push_back(it -> value);
+  ASSERT_EQ(4, vs.size());
+  ASSERT_EQ("b", vs[0]);
+  ASSERT_EQ("e", vs[3]);
+  auto r = c.equal_range(40);
+  ASSERT_EQ("d", r.first -> value);
+  ASSERT_EQ(1, std::distance(r.first, r.second));
+  r = c.equal_range(45);
+  ASSERT_EQ(r.first, r.second);
+}
+
+
+TEST(OrderStatisticsTest, RankSelectCount)
+{
+  AVLCollection<int,int,ThreeWayCompare,SlabAllocator,OrderStatistics> c;
+  // even keys 0..1998
+  for(int i = 0; i < 1000; ++i)
+    c.add(i * 37 % 1000 * 2, i);
+  ASSERT_EQ(0, c.rank(0));
+  ASSERT_EQ(1, c.rank(1));
+  ASSERT_EQ(50, c.rank(100));
+  ASSERT_EQ(1000, c.rank(5000));
+  ASSERT_EQ(0, c.select(0) -> key);
+  ASSERT_EQ(200, c.select(100) -> key);
+  ASSERT_EQ(1998, c.select(999) -> key);
+  ASSERT_EQ(c.end(), c.select(1000));
+  ASSERT_EQ(202, (++c.select(100)) -> key);
+  ASSERT_EQ(11, c.count_range(100, 120));
+  ASSERT_EQ(10, c.count_range(101, 120));
+  ASSERT_EQ(0, c.count_range(120, 100));
+  // sizes follow removes, copies and bulk loads
+  for(int i = 0; i < 500; ++i)
+    c.remove(i * 2);
+  ASSERT_EQ(1000, c.select(0) -> key);
+  ASSERT_EQ(250, c.rank(1500));
+  AVLCollection<int,int,ThreeWayCompare,SlabAllocator,OrderStatistics> c2(c);
+  ASSERT_EQ(1500, c2.select(250) -> key);
+  vector<pair<int,int>> kvs = {{1, 1}, {2, 2}, {3, 3}};
+  c2.bulk_load(kvs.begin(), kvs.end());
+  ASSERT_EQ(2, c2.count_range(2, 3));
+}
+
+
+TEST(BulkLoadTest, SortedInput)
+{
+  vector<pair<int,int>> kvs;
+  for(int i = 0; i < 1000; ++i)
+    kvs.push_back(make_pair(i, i * 10));
+  AVLCollection<int,int> c = AVLCollection<int,int>::from_sorted(kvs.begin(), kvs.end());
+  ASSERT_EQ(1000, c.size());
+  // a perfectly balanced tree of 1000 nodes has height 10
+  ASSERT_EQ(10, c.height());
+  int v;
+  ASSERT_EQ(true, c.find(999, v));
+  ASSERT_EQ(9990, v);
+  // the loaded tree is still a working AVL tree
+  for(int i = 1000; i < 1100; ++i)
+    c.add(i, i);
+  for(int i = 0; i < 500; ++i)
+    ASSERT_EQ(true, c.remove(i));
+  ASSERT_EQ(600, c.size());
+  ASSERT_LE(c.height(), 11);
+}
+
+
+TEST(BulkLoadTest, UnsortedInput)
+{
+  vector<pair<string,int>> kvs = {{"d", 40}, {"a", 10}, {"c", 30}, {"b", 20}, {"e", 50}};
+  AVLCollection<string,int> c(kvs.begin(), kvs.end());
+  ASSERT_EQ(5, c.size());
+  ASSERT_EQ(3, c.height());
+  vector<string> ks;
+  c.sort(ks);
+  ASSERT_EQ("a", ks[0]);
+  ASSERT_EQ("e", ks[4]);
+  int v;
+  ASSERT_EQ(true, c.find("c", v));
+  ASSERT_EQ(30, v);
+  // reloading replaces the old contents
+  c.bulk_load(kvs.begin(), kvs.begin() + 2);
+  ASSERT_EQ(2, c.size());
+  ASSERT_EQ(false, c.find("c", v));
+}
+
+
+TEST(AllocatorTest, SlabReusesRemovedNodes)
+{
+  AVLCollection<int,int> c;
+  for(int i = 0; i < 100; ++i)
+    c.add(i, i);
+  ASSERT_EQ(100, c.node_allocations());
+  long blocks = c.heap_allocations();
+  ASSERT_LT(blocks, 100);
+  for(int i = 0; i < 50; ++i)
+    c.remove(i);
+  for(int i = 100; i < 150; ++i)
+    c.add(i, i);
+  // removed nodes come back off the free list, no new blocks
+  ASSERT_EQ(blocks, c.heap_allocations());
+  ASSERT_EQ(100, c.size());
+  int v;
+  ASSERT_EQ(true, c.find(149, v));
+  ASSERT_EQ(false, c.find(10, v));
+}
+
+
+TEST(AllocatorTest, NewDeleteAllocator)
+{
+  AVLCollection<string,int,ThreeWayCompare,NewDeleteAllocator> c;
+  c.add("b", 20);
+  c.add("a", 10);
+  c.add("c", 30);
+  ASSERT_EQ(3, c.node_allocations());
+  ASSERT_EQ(3, c.heap_allocations());
+  c.remove("a");
+  ASSERT_EQ(2, c.size());
+  AVLCollection<string,int,ThreeWayCompare,NewDeleteAllocator> c2(c);
+  ASSERT_EQ(2, c2.size());
+}
+
+
+TEST(AllocatorTest, NewDeleteBytesAfterSetOperations)
+{
+  typedef AVLCollection<int,int,ThreeWayCompare,NewDeleteAllocator> HeapTree;
+  const std::size_t base = HeapTree().memory_bytes();
+  HeapTree a, b;
+  for(int i = 0; i < 10; ++i)
+  {
+    a.add(i, i);
+    b.add(i + 10, i);
+  }
+  const std::size_t node = (a.memory_bytes() - base) / 10;
+  ASSERT_GT(node, 0u);
+  // b's nodes are copied into a and freed by b
+  a.union_with(std::move(b));
+  ASSERT_EQ(base + 20 * node, a.memory_bytes());
+  ASSERT_EQ(base, b.memory_bytes());
+  // the halves of a split count their nodes together
+  HeapTree upper = a.split(15);
+  ASSERT_EQ(base + 20 * node, a.memory_bytes());
+  ASSERT_EQ(base + 20 * node, upper.memory_bytes());
+  a.join(std::move(upper));
+  ASSERT_EQ(20, a.size());
+  for(int i = 0; i < 20; ++i)
+    ASSERT_EQ(true, a.remove(i));
+  ASSERT_EQ(base, a.memory_bytes());
+  ASSERT_EQ(base, a.stats().memory_bytes);
+}
+
+TEST(CompactTest, BasicOperations)
+{
+  CompactAVLCollection<int,int> c;
+  for(int i = 0; i < 1000; ++i)
+    c.add((i * 7919) % 1000, i);
+  ASSERT_EQ(1000, c.size());
+  ASSERT_GE(14, c.height());
+  for(int i = 0; i < 1000; i += 2)
+    ASSERT_EQ(true, c.remove(i));
+  ASSERT_EQ(false, c.remove(0));
+  ASSERT_EQ(500, c.size());
+  ASSERT_GE(13, c.height());
+  int v;
+  ASSERT_EQ(false, c.find(10, v));
+  ASSERT_EQ(true, c.find(11, v));
+  vector<int> ks;
+  c.sort(ks);
+  for(int i = 0; i < 500; ++i)
+    ASSERT_EQ(2 * i + 1, ks[i]);
+  vector<int> vs;
+  c.find(100, 110, vs);
+  ASSERT_EQ(5, vs.size());
+}
+
+
+TEST(CompactTest, ReusesFreedNodes)
+{
+  CompactAVLCollection<string,double> c;
+  c.add("b", 2.0);
+  c.add("a", 1.0);
+  c.add("c", 3.0);
+  size_t bytes = c.memory_bytes();
+  c.remove("a");
+  c.add("d", 4.0);
+  ASSERT_EQ(bytes, c.memory_bytes());
+  double v;
+  ASSERT_EQ(true, c.find("d", v));
+  ASSERT_EQ(4.0, v);
+  // smaller per-entry footprint than the pointer-linked layout
+  AVLCollection<string,double> p;
+  for(int i = 0; i < 4096; ++i) {
+    c.add(to_string(i), i);
+    p.add(to_string(i), i);
+  }
+  ASSERT_LT(c.memory_bytes(), p.memory_bytes());
+}
+
+
+TEST(FrozenTest, MatchesTree)
+{
+  for(int n : {0, 1, 2, 7, 8, 100, 1000}) {
+    AVLCollection<int,int> c;
+    for(int i = 0; i < n; ++i)
+      c.add(2 * i, i);
+    FrozenAVLCollection<int,int,ThreeWayCompare> f = c.freeze();
+    ASSERT_EQ(n, f.size());
+    int v;
+    for(int i = 0; i < n; ++i) {
+      ASSERT_EQ(true, f.find(2 * i, v));
+      ASSERT_EQ(i, v);
+      ASSERT_EQ(false, f.find(2 * i + 1, v));
+    }
+    ASSERT_EQ(false, f.find(-1, v));
+    vector<int> ks1, ks2;
+    c.sort(ks1);
+    f.sort(ks2);
+    ASSERT_EQ(ks1, ks2);
+    vector<int> vs1, vs2;
+    c.find(5, 41, vs1);
+    f.find(5, 41, vs2);
+    ASSERT_EQ(vs1, vs2);
+  }
+}
+
+
+TEST(FrozenTest, StringKeys)
+{
+  AVLCollection<string,double> c;
+  c.add("b", 2.0);
+  c.add("a", 1.0);
+  c.add("d", 4.0);
+  FrozenAVLCollection<string,double,ThreeWayCompare> f = c.freeze();
+  c.add("c", 3.0);
+  ASSERT_EQ(3, f.size());
+  ASSERT_EQ(2, f.height());
+  double v;
+  ASSERT_EQ(false, f.find("c", v));
+  ASSERT_EQ(true, f.find("d", v));
+  ASSERT_EQ(4.0, v);
+  vector<double> vs;
+  f.find("b", "z", vs);
+  ASSERT_EQ(2, vs.size());
+}
+
+
+// adds keys in a scattered order, removes every other one and checks
+// the rest are all still there, in order
+template<typename Coll, typename MakeKey>
+void btree_add_remove(Coll& c, MakeKey make_key)
+{
+  const int n = 5000;
+  for(int i = 0; i < n; ++i)
+    c.add(make_key((i * 7919) % n), i);
+  ASSERT_EQ(n, c.size());
+  for(int i = 0; i < n; i += 2)
+    ASSERT_EQ(true, c.remove(make_key(i)));
+  ASSERT_EQ(false, c.remove(make_key(0)));
+  ASSERT_EQ(n / 2, c.size());
+  int v;
+  for(int i = 0; i < n; ++i)
+    ASSERT_EQ(i % 2 == 1, c.find(make_key(i), v));
+  vector<decltype(make_key(0))> sorted;
+  c.sort(sorted);
+  ASSERT_EQ(n / 2, sorted.size());
+  for(int i = 0; i < n / 2; ++i)
+    ASSERT_EQ(make_key(2 * i + 1), sorted[i]);
+  vector<int> vs;
+  c.find(make_key(100), make_key(109), vs);
+  ASSERT_EQ(5, vs.size());
+  for(int i = 1; i < n; i += 2)
+    c.remove(make_key(i));
+  ASSERT_EQ(0, c.size());
+  ASSERT_EQ(0, c.height());
+}
+
+
+TEST(BTreeTest, IntKeys)
+{
+  BTreeCollection<int,int> c;
+  btree_add_remove(c, [](int i) { return i - 2500; });
+  BTreeCollection<unsigned long,int> u;
+  btree_add_remove(u, [](int i) { return (unsigned long)(i) << 40; });
+}
+
+
+TEST(BTreeTest, StringAndFixedKeys)
+{
+  auto name = [](int i) { string s = to_string(i); return string(5 - s.size(), '0') + s; };
+  BTreeCollection<string,int> c;
+  btree_add_remove(c, name);
+  BTreeCollection<FixedKey<5>,int> f;
+  btree_add_remove(f, [&name](int i) { return FixedKey<5>(name(i)); });
+}
+
+
+TEST(MappedTest, SaveAndMap)
+{
+  const string file = "avl_test_image.bin";
+  AVLCollection<int,double> c;
+  for(int i = 0; i < 1000; ++i)
+    c.add((i * 7919) % 1000 * 2, i);
+  ASSERT_EQ(true, save_image(c, file));
+  MappedAVLCollection<int,double> m(file);
+  ASSERT_EQ(true, m.is_open());
+  ASSERT_EQ(1000, m.size());
+  double v1, v2;
+  for(int k = -1; k < 2001; ++k) {
+    ASSERT_EQ(c.find(k, v1), m.find(k, v2));
+    if(k % 2 == 0 && k >= 0 && k < 2000) {
+      ASSERT_EQ(v1, v2);
+    }
+  }
+  vector<double> vs1, vs2;
+  c.find(11, 100, vs1);
+  m.find(11, 100, vs2);
+  ASSERT_EQ(vs1, vs2);
+  AVLCollection<int,double> loaded;
+  ASSERT_EQ(true, load_image(loaded, file));
+  ASSERT_EQ(1000, loaded.size());
+  vector<int> ks1, ks2;
+  c.sort(ks1);
+  loaded.sort(ks2);
+  ASSERT_EQ(ks1, ks2);
+  // an image holds one key and value layout
+  MappedAVLCollection<string,double> wrong(file);
+  ASSERT_EQ(false, wrong.is_open());
+  std::remove(file.c_str());
+  MappedAVLCollection<int,double> missing(file);
+  ASSERT_EQ(false, missing.is_open());
+}
+
+
+TEST(MappedTest, StringKeysAndValues)
+{
+  const string file = "avl_test_image.bin";
+  AVLCollection<string,string> c;
+  c.add("pear", "green");
+  c.add("apple", "red");
+  c.add("fig", "");
+  c.add("banana", "yellow");
+  ASSERT_EQ(true, save_image(c, file));
+  MappedAVLCollection<string,string> m(file);
+  ASSERT_EQ(true, m.is_open());
+  string v;
+  ASSERT_EQ(true, m.find("apple", v));
+  ASSERT_EQ("red", v);
+  ASSERT_EQ(true, m.find("fig", v));
+  ASSERT_EQ("", v);
+  ASSERT_EQ(false, m.find("grape", v));
+  vector<string> ks;
+  m.sort(ks);
+  ASSERT_EQ(vector<string>({"apple", "banana", "fig", "pear"}), ks);
+  vector<string> vs;
+  m.find("b", "g", vs);
+  ASSERT_EQ(vector<string>({"yellow", ""}), vs);
+  AVLCollection<string,string> empty;
+  ASSERT_EQ(true, save_image(empty, file));
+  MappedAVLCollection<string,string> m2(file);
+  ASSERT_EQ(true, m2.is_open());
+  ASSERT_EQ(0, m2.size());
+  ASSERT_EQ(false, m2.find("apple", v));
+  std::remove(file.c_str());
+}
+
+
+TEST(DurableTest, RecoversFromLogAndCheckpoint)
+{
+  const string base = "avl_test_durable";
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+  DurableOptions options;
+  options.batch_size = 16;
+  options.checkpoint_records = 250;
+  {
+    DurableAVLCollection<string,int> c(base, options);
+    ASSERT_EQ(true, c.is_open());
+    for(int i = 0; i < 1000; ++i)
+      c.add(to_string(i), i);
+    for(int i = 0; i < 1000; i += 3)
+      c.remove(to_string(i));
+    ASSERT_EQ(666, c.size());
+    ASSERT_GT(c.log_syncs(), 0);
+  }
+  {
+    DurableAVLCollection<string,int> c(base, options);
+    ASSERT_EQ(true, c.is_open());
+    ASSERT_EQ(666, c.size());
+    int v;
+    ASSERT_EQ(false, c.find("3", v));
+    ASSERT_EQ(true, c.find("998", v));
+    ASSERT_EQ(998, v);
+    // a checkpoint leaves nothing in the log to replay
+    c.add("extra", -1);
+    ASSERT_EQ(true, c.checkpoint());
+  }
+  DurableAVLCollection<string,int> c(base, options);
+  ASSERT_EQ(0, c.recovered_records());
+  ASSERT_EQ(667, c.size());
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+}
+
+
+TEST(DurableTest, IgnoresTornTail)
+{
+  const string base = "avl_test_durable";
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+  DurableOptions options;
+  options.batch_size = 1;
+  {
+    DurableAVLCollection<int,double> c(base, options);
+    for(int i = 0; i < 10; ++i)
+      c.add(i, i * 0.5);
+  }
+  // simulate a crash in the middle of writing one more record
+  FILE* log = fopen((base + ".log").c_str(), "ab");
+  fwrite("\x15\0\0\0garbage", 1, 11, log);
+  fclose(log);
+  {
+    DurableAVLCollection<int,double> c(base, options);
+    ASSERT_EQ(10, c.recovered_records());
+    ASSERT_EQ(10, c.size());
+    c.add(10, 5.0);
+  }
+  DurableAVLCollection<int,double> c(base, options);
+  ASSERT_EQ(11, c.size());
+  double v;
+  ASSERT_EQ(true, c.find(10, v));
+  ASSERT_EQ(5.0, v);
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+}
+
+
+TEST(DurableTest, BacksOffFailedCheckpoint)
+{
+  const string base = "avl_test_durable";
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+  // a directory where the checkpoint is written makes it fail
+  const string temp = base + ".ckpt.tmp";
+  ASSERT_EQ(0, mkdir(temp.c_str(), 0755));
+  DurableOptions options;
+  options.batch_size = 1000;
+  options.sync_interval = std::chrono::hours(1);
+  options.checkpoint_records = 10;
+  {
+    DurableAVLCollection<int,int> c(base, options);
+    for(int i = 0; i < 10; ++i)
+      c.add(i, i);
+    ASSERT_NE(0, c.io_error());
+    long syncs = c.log_syncs();
+    // the next updates don't retry it (each retry would sync)
+    for(int i = 10; i < 15; ++i)
+      c.add(i, i);
+    ASSERT_EQ(syncs, c.log_syncs());
+    // a full interval later it is tried again
+    rmdir(temp.c_str());
+    for(int i = 15; i < 20; ++i)
+      c.add(i, i);
+    ASSERT_EQ(syncs + 1, c.log_syncs());
+    ASSERT_EQ(0, c.io_error());
+  }
+  DurableAVLCollection<int,int> c(base, options);
+  ASSERT_EQ(0, c.recovered_records());
+  ASSERT_EQ(20, c.size());
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+}
+
+
+TEST(DurableTest, RetriesFailedBatch)
+{
+  const string base = "avl_test_durable";
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+  DurableOptions options;
+  options.batch_size = 4;
+  options.sync_interval = std::chrono::hours(1);
+  options.checkpoint_records = 0;
+  {
+    DurableAVLCollection<int,int> c(base, options);
+    for(int i = 0; i < 8; ++i)
+      c.add(i, i);
+    ASSERT_EQ(0, c.io_error());
+    struct stat st;
+    ASSERT_EQ(0, stat((base + ".log").c_str(), &st));
+    // let the next batch only partly reach the log
+    rlimit old_limit;
+    getrlimit(RLIMIT_FSIZE, &old_limit);
+    rlimit limit = old_limit;
+    limit.rlim_cur = st.st_size + 10;
+    auto old_handler = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &limit);
+    for(int i = 8; i < 12; ++i)
+      c.add(i, i);
+    setrlimit(RLIMIT_FSIZE, &old_limit);
+    signal(SIGXFSZ, old_handler);
+    ASSERT_NE(0, c.io_error());
+    struct stat cut;
+    ASSERT_EQ(0, stat((base + ".log").c_str(), &cut));
+    ASSERT_EQ(st.st_size, cut.st_size);
+    // the kept batch goes out with the next one
+    for(int i = 12; i < 16; ++i)
+      c.add(i, i);
+    ASSERT_EQ(0, c.io_error());
+  }
+  DurableAVLCollection<int,int> c(base, options);
+  ASSERT_EQ(16, c.recovered_records());
+  ASSERT_EQ(16, c.size());
+  for(int i = 0; i < 16; ++i)
+  {
+    int v;
+    ASSERT_EQ(true, c.find(i, v));
+    ASSERT_EQ(i, v);
+  }
+  std::remove((base + ".log").c_str());
+  std::remove((base + ".ckpt").c_str());
+}
+
+
+TEST(SetAlgebraTest, SplitAndJoin)
+{
+  AVLCollection<int,int> c;
+  for(int i = 0; i < 1000; ++i)
+    c.add(i * 37 % 1000, i);
+  AVLCollection<int,int> upper = c.split(300);
+  ASSERT_EQ(300, c.size());
+  ASSERT_EQ(700, upper.size());
+  ASSERT_EQ(299, (--c.end()) -> key);
+  ASSERT_EQ(300, upper.begin() -> key);
+  ASSERT_LE(c.height(), 12);
+  ASSERT_LE(upper.height(), 13);
+  // the halves share a pool until one is copied
+  ASSERT_EQ(true, upper.shares_allocator());
+  ASSERT_EQ(false, (AVLCollection<int,int>(upper).shares_allocator()));
+  // splitting at a missing key, then joining around it
+  AVLCollection<int,int> top = upper.split(900);
+  ASSERT_EQ(true, upper.remove(500));
+  AVLCollection<int,int> middle = upper.split(500);
+  upper.join(500, -1, std::move(middle));
+  ASSERT_EQ(0, middle.size());
+  c.join(std::move(upper));
+  c.join(std::move(top));
+  ASSERT_EQ(1000, c.size());
+  ASSERT_LE(c.height(), 14);
+  vector<int> keys;
+  c.sort(keys);
+  for(int i = 0; i < 1000; ++i)
+    ASSERT_EQ(i, keys[i]);
+  int v;
+  ASSERT_EQ(true, c.find(500, v));
+  ASSERT_EQ(-1, v);
+  // subtree sizes survive split and join
+  AVLCollection<int,int,ThreeWayCompare,SlabAllocator,OrderStatistics> s;
+  for(int i = 0; i < 100; ++i)
+    s.add(i, i);
+  auto s_upper = s.split(40);
+  ASSERT_EQ(40, s.size());
+  ASSERT_EQ(10, s_upper.rank(50));
+  s_upper.join(std::move(s));
+}
+
+
+TEST(SetAlgebraTest, UnionIntersectDifference)
+{
+  for(int threads : {1, 4})
+  {
+    // multiples of 2 and of 3 below 60000
+    auto make = [](int step) {
+      AVLCollection<int,int> c;
+      for(int i = 0; i < 60000; i += step)
+        c.add(i, step);
+      return c;
+    };
+    AVLCollection<int,int> u = make(2);
+    u.union_with(make(3), threads);
+    AVLCollection<int,int> n = make(2);
+    n.intersect_with(make(3), threads);
+    AVLCollection<int,int> d = make(2);
+    d.difference(make(3), threads);
+    ASSERT_EQ(40000, u.size());
+    ASSERT_EQ(10000, n.size());
+    ASSERT_EQ(20000, d.size());
+    ASSERT_LE(u.height(), 22);
+    for(int i = 0; i < 60000; ++i)
+    {
+      int v;
+      ASSERT_EQ(i % 2 == 0 || i % 3 == 0, u.find(i, v));
+      if(i % 2 == 0)
+      {
+        ASSERT_EQ(2, v);
+      }
+      ASSERT_EQ(i % 6 == 0, n.find(i, v));
+      ASSERT_EQ(i % 2 == 0 && i % 3 != 0, d.find(i, v));
+    }
+  }
+  // the other collection's nodes are copied if it has its own
+  // allocator
+  AVLCollection<string,int,ThreeWayCompare,NewDeleteAllocator> a, b;
+  a.add("x", 1);
+  b.add("y", 2);
+  b.add("x", 3);
+  a.union_with(std::move(b));
+  ASSERT_EQ(2, a.size());
+  ASSERT_EQ(0, b.size());
+  AVLCollection<string,int> e, f;
+  f.add("z", 1);
+  e.union_with(std::move(f));
+  e.intersect_with(AVLCollection<string,int>());
+  ASSERT_EQ(0, e.size());
+}
+
+
+TEST(BatchTest, InsertAndErase)
+{
+  for(int threads : {1, 4})
+  {
+    AVLCollection<int,int> c;
+    for(int i = 0; i < 20000; i += 2)
+      c.add(i, 0);
+    // odd keys are new, multiples of 4 replace existing values, and
+    // the last of the repeated keys wins
+    vector<pair<int,int>> kvs;
+    for(int i = 0; i < 40000; ++i)
+    {
+      int key = i * 7919 % 40000;
+      if(key % 2 == 1 || key % 4 == 0)
+        kvs.push_back(make_pair(key, 1));
+    }
+    kvs.push_back(make_pair(3, 2));
+    c.insert_batch(kvs, threads);
+    ASSERT_EQ(35000, c.size());
+    ASSERT_LE(c.height(), 21);
+    int v;
+    ASSERT_EQ(true, c.find(3, v));
+    ASSERT_EQ(2, v);
+    ASSERT_EQ(true, c.find(8, v));
+    ASSERT_EQ(1, v);
+    ASSERT_EQ(true, c.find(6, v));
+    ASSERT_EQ(0, v);
+    vector<int> erase_keys;
+    for(int i = 0; i < 40000; i += 3)
+      erase_keys.push_back(i);
+    erase_keys.push_back(0);
+    ASSERT_EQ(11668, c.erase_batch(erase_keys, threads));
+    ASSERT_EQ(23332, c.size());
+    vector<int> keys;
+    c.sort(keys);
+    ASSERT_EQ(23332u, keys.size());
+    for(size_t i = 0; i + 1 < keys.size(); ++i)
+      ASSERT_LT(keys[i], keys[i + 1]);
+    for(int key : keys)
+      ASSERT_NE(0, key % 3);
+  }
+}
+
+
+TEST(TeardownTest, ClearInBackground)
+{
+  AVLCollection<string,int> c;
+  for(int i = 0; i < 10000; ++i)
+    c.add(to_string(i), i);
+  ASSERT_EQ(true, c.clear_in_background());
+  ASSERT_EQ(0, c.size());
+  ASSERT_EQ(0, c.height());
+  // the collection is usable at once with a fresh allocator
+  c.add("a", 1);
+  int v;
+  ASSERT_EQ(true, c.find("a", v));
+  // a second clear takes over the first one's thread
+  c.add("c", 3);
+  ASSERT_EQ(true, c.clear_in_background());
+  c.wait_for_clear();
+  ASSERT_EQ(0, c.size());
+  c.add("a", 1);
+  // a pool shared with another collection is cleared in place
+  AVLCollection<string,int> upper = c.split("b");
+  upper.add("b", 2);
+  ASSERT_EQ(false, upper.clear_in_background());
+  ASSERT_EQ(0, upper.size());
+  ASSERT_EQ(1, c.size());
+}
+
+
+TEST(TraceTest, TextAndBinaryFormats)
+{
+  const string text = "avl_test_trace.txt";
+  const string binary = "avl_test_trace.bin";
+  {
+    ofstream out(text);
+    out << "add AB 1.25\nadd CD 2\n  find AB\nrange AB CD\nremove CD\nsort\nadd EF";
+  }
+  Trace t;
+  ASSERT_EQ(true, t.load_text(text));
+  // the last add has no value and is dropped
+  ASSERT_EQ(6u, t.size());
+  ASSERT_EQ(2u, t.key_count());
+  const TraceOp* op = t.begin();
+  ASSERT_EQ(TraceOpType::add, op[0].type);
+  ASSERT_EQ(1.25, op[0].val);
+  ASSERT_EQ("AB", t.key(op[0].key1));
+  ASSERT_EQ(op[0].key1, op[2].key1);
+  ASSERT_EQ("CD", t.key(op[3].key2));
+  ASSERT_EQ(TraceOpType::sort, op[5].type);
+  ASSERT_EQ(true, t.save_binary(binary));
+
+  Trace b;
+  ASSERT_EQ(true, b.load(binary));
+  ASSERT_EQ(t.size(), b.size());
+  ASSERT_EQ(0, memcmp(t.begin(), b.begin(), t.size() * sizeof(TraceOp)));
+  ASSERT_EQ("CD", b.key(1));
+  // a text file isn't a binary trace
+  ASSERT_EQ(false, b.load_binary(text));
+  ASSERT_EQ(0u, b.size());
+  std::remove(text.c_str());
+  std::remove(binary.c_str());
+}
+
+
+TEST(BenchTest, SummarizesTrace)
+{
+  const string trace = "avl_test_trace.txt";
+  {
+    ofstream out(trace);
+    for(int i = 0; i < 100; ++i)
+      out << "add K" << i << " " << i << ".5" << endl;
+    for(int i = 0; i < 50; ++i)
+      out << "find K" << i * 3 << endl;
+    out << "range K1 K5" << endl << "remove K7" << endl << "sort" << endl;
+  }
+  Trace ops;
+  ASSERT_EQ(true, ops.load_text(trace));
+  ASSERT_EQ(153u, ops.size());
+  BenchOptions options;
+  options.warmup = 1;
+  options.repeats = 3;
+  BenchHarness<string,double> harness("avl", ops, options);
+  harness.run([] { return make_unique<AVLCollection<string,double>>(); });
+  LatencySummary finds = harness.summary(TraceOpType::find);
+  ASSERT_EQ(150, finds.count);
+  ASSERT_LE(finds.min, finds.median);
+  ASSERT_LE(finds.median, finds.p99);
+  ASSERT_LE(finds.p999, finds.max);
+  long bucketed = 0;
+  for(long n : finds.histogram)
+    bucketed += n;
+  ASSERT_EQ(150, bucketed);
+  ASSERT_LT(0, harness.throughput());
+  // one header row plus one row per op type
+  ostringstream csv;
+  harness.write_csv(csv, true);
+  string rows = csv.str();
+  ASSERT_EQ(6, count(rows.begin(), rows.end(), '\n'));
+  ostringstream json;
+  harness.write_json(json);
+  ASSERT_NE(string::npos, json.str().find("\"remove\": {\"count\": 3,"));
+  std::remove(trace.c_str());
+}
+
+
+TEST(WorkloadTest, GeneratesValidTraces)
+{
+  const string text = "avl_test_workload.txt";
+  const string binary = "avl_test_workload.bin";
+  WorkloadOptions options;
+  options.records = 500;
+  options.operations = 2000;
+  options.key_length = 6;
+  options.find_ratio = options.update_ratio = options.insert_ratio = 1;
+  options.remove_ratio = options.range_ratio = 1;
+  options.sort_ratio = 0.01;
+  WorkloadGenerator generator(options);
+  ASSERT_EQ(true, generator.valid());
+  ASSERT_EQ(true, generator.write_text(text));
+  ASSERT_EQ(true, generator.write_binary(binary));
+
+  // finds, updates and removes only touch live keys, and adds only
+  // add new ones
+  Trace t;
+  ASSERT_EQ(true, t.load(text));
+  set<string_view> live;
+  long counts[trace_op_types] = {};
+  for(const TraceOp& op : t)
+  {
+    counts[int(op.type)]++;
+    if(op.type != TraceOpType::sort)
+    {
+      ASSERT_EQ(6u, t.key(op.key1).size());
+    }
+    if(op.type == TraceOpType::add)
+    {
+      ASSERT_EQ(true, live.insert(t.key(op.key1)).second);
+    }
+    else if(op.type == TraceOpType::remove)
+    {
+      ASSERT_EQ(1u, live.erase(t.key(op.key1)));
+    }
+    else if(op.type == TraceOpType::find || op.type == TraceOpType::range)
+    {
+      ASSERT_EQ(1u, live.count(t.key(op.key1)));
+    }
+    if(op.type == TraceOpType::range)
+    {
+      ASSERT_LE(t.key(op.key1), t.key(op.key2));
+    }
+  }
+  // 500 loads, then about 400 of each run phase op (updates count as a
+  // remove and an add)
+  ASSERT_NEAR(500 + 800, counts[int(TraceOpType::add)], 100);
+  ASSERT_NEAR(800, counts[int(TraceOpType::remove)], 100);
+  ASSERT_NEAR(400, counts[int(TraceOpType::find)], 100);
+
+  // the binary trace has the same ops on the same keys
+  Trace b;
+  ASSERT_EQ(true, b.load(binary));
+  ASSERT_EQ(t.size(), b.size());
+  for(size_t i = 0; i < t.size(); ++i)
+  {
+    const TraceOp& x = t.begin()[i];
+    const TraceOp& y = b.begin()[i];
+    ASSERT_EQ(x.type, y.type);
+    ASSERT_EQ(x.val, y.val);
+    if(x.type != TraceOpType::sort)
+    {
+      ASSERT_EQ(t.key(x.key1), b.key(y.key1));
+    }
+    if(x.type == TraceOpType::range)
+    {
+      ASSERT_EQ(t.key(x.key2), b.key(y.key2));
+    }
+  }
+  std::remove(text.c_str());
+  std::remove(binary.c_str());
+}
+
+
+TEST(WorkloadTest, ZipfianSkewAndPresets)
+{
+  WorkloadOptions options;
+  ASSERT_EQ(false, workload_preset("f", options));
+  ASSERT_EQ(true, workload_preset("c", options));
+  options.records = 1000;
+  options.operations = 20000;
+  options.load = false;
+  map<uint64_t,int> hits;
+  WorkloadGenerator generator(options);
+  generator.generate([&](TraceOpType type, const WorkloadKey& key, const WorkloadKey&, double) {
+    ASSERT_EQ(TraceOpType::find, type);
+    hits[key.code]++;
+  });
+  // the most popular record takes far more than its uniform share
+  int most = 0;
+  for(auto& hit : hits)
+    most = max(most, hit.second);
+  ASSERT_LT(20 * 20, most);
+  // keys too short for every record are rejected
+  options.key_length = 2;
+  ASSERT_EQ(false, WorkloadGenerator(options).valid());
+}
+
+
+TEST(StdCollectionTest, AdaptersMatchAVL)
+{
+  AVLCollection<int,int> avl;
+  MapCollection<int,int> ordered;
+  HashCollection<int,int> hashed;
+  Collection<int,int>* colls[] = {&avl, &ordered, &hashed};
+  for(Collection<int,int>* c : colls)
+  {
+    for(int i = 0; i < 200; ++i)
+      c -> add((i * 37) % 200, i);
+    for(int i = 0; i < 200; i += 3)
+      ASSERT_EQ(true, c -> remove(i));
+    ASSERT_EQ(false, c -> remove(0));
+  }
+  for(Collection<int,int>* c : colls)
+  {
+    ASSERT_EQ(avl.size(), c -> size());
+    int v = -1;
+    ASSERT_EQ(true, c -> find(37, v));
+    ASSERT_EQ(1, v);
+    ASSERT_EQ(false, c -> find(3, v));
+    vector<int> expected, vals;
+    avl.find(50, 80, expected);
+    c -> find(50, 80, vals);
+    std::sort(expected.begin(), expected.end());
+    std::sort(vals.begin(), vals.end());
+    ASSERT_EQ(expected, vals);
+    vector<int> sorted, ks;
+    avl.sort(sorted);
+    c -> sort(ks);
+    ASSERT_EQ(sorted, ks);
+  }
+}
+
+
+TEST(StdCollectionTest, PointOpsOnlyReplay)
+{
+  const string trace = "avl_test_trace.txt";
+  {
+    ofstream out(trace);
+    out << "add A 1\nadd B 2\nfind A\nrange A B\nsort\nremove B\n";
+  }
+  Trace ops;
+  ASSERT_EQ(true, ops.load_text(trace));
+  BenchOptions options;
+  options.warmup = 0;
+  options.repeats = 1;
+  options.point_ops_only = true;
+  BenchHarness<string,double> harness("hash", ops, options);
+  ASSERT_EQ(4u, harness.replayed_ops());
+  harness.run([] { return make_unique<HashCollection<string,double>>(); });
+  ASSERT_EQ(1, harness.summary(TraceOpType::find).count);
+  ASSERT_EQ(0, harness.summary(TraceOpType::range).count);
+  ASSERT_EQ(0, harness.summary(TraceOpType::sort).count);
+  HashCollection<string,double> left;
+  harness.replay(left);
+  ASSERT_EQ(1, left.size());
+  std::remove(trace.c_str());
+}
+
+
+TEST(StatsTest, CountersAndShape)
+{
+  AVLCollection<int,int> c;
+  c.add(1, 1);
+  c.add(2, 2);
+  c.add(3, 3);
+  AVLOpCounters n = c.counters();
+  // without AVL_COUNTERS every count stays zero
+  long on = c.counting ? 1 : 0;
+  ASSERT_EQ(3 * on, n.comparisons);
+  ASSERT_EQ(1 * on, n.single_rotations);
+  ASSERT_EQ(0, n.double_rotations);
+  ASSERT_EQ(3 * on, n.node_visits);
+  ASSERT_EQ(3 * on, n.allocations);
+  c.reset_counters();
+  // 5 hangs right of 3, then 4 makes 3 right-left heavy
+  c.add(5, 5);
+  c.add(4, 4);
+  int v;
+  ASSERT_EQ(true, c.find(4, v));
+  n = c.counters();
+  ASSERT_EQ(7 * on, n.comparisons);
+  ASSERT_EQ(0, n.single_rotations);
+  ASSERT_EQ(1 * on, n.double_rotations);
+  ASSERT_EQ(2 * on, n.allocations);
+
+  // the tree is now 2 (1, 4 (3, 5))
+  AVLTreeStats shape = c.stats();
+  ASSERT_EQ(5, shape.size);
+  ASSERT_EQ(3, shape.height);
+  ASSERT_EQ(3, shape.max_depth);
+  ASSERT_DOUBLE_EQ(2.2, shape.average_depth);
+  ASSERT_EQ(0, shape.left_heavy);
+  ASSERT_EQ(4, shape.balanced);
+  ASSERT_EQ(1, shape.right_heavy);
+  ASSERT_EQ(c.memory_bytes(), shape.memory_bytes);
+  ASSERT_EQ(n.comparisons, shape.counters.comparisons);
+  AVLCollection<int,int> empty;
+  ASSERT_EQ(0, empty.stats().max_depth);
+}
+
+
+// readers check that every key they see has its own value while a
+// writer adds and removes keys
+template<typename Coll>
+void concurrent_readers_and_writer(Coll& c)
+{
+  for(int i = 0; i < 1000; ++i)
+    c.add(i, i * 2);
+  vector<thread> readers;
+  vector<int> errors(4, 0);
+  for(int t = 0; t < 4; ++t)
+    readers.push_back(thread([&c, &errors, t]() {
+      for(int round = 0; round < 20; ++round)
+        for(int i = 0; i < 1000; ++i) {
+          int v;
+          if(!c.find(i, v) || v != i * 2)
+            errors[t]++;
+        }
+    }));
+  for(int i = 1000; i < 1200; ++i) {
+    c.add(i, i * 2);
+    c.remove(i);
+  }
+  for(thread& t : readers)
+    t.join();
+  for(int e : errors)
+    ASSERT_EQ(0, e);
+  ASSERT_EQ(1000, c.size());
+}
+
+
+TEST(ConcurrentTest, SharedLock)
+{
+  SharedAVLCollection<int,int> c;
+  concurrent_readers_and_writer(c);
+  int total = 0;
+  c.visit_range(0, 9, [&total](int k, int v) { total += v; });
+  ASSERT_EQ(90, total);
+}
+
+
+TEST(ConcurrentTest, Snapshot)
+{
+  SnapshotAVLCollection<int,int> c;
+  concurrent_readers_and_writer(c);
+  // a snapshot does not see later writes
+  SnapshotAVLCollection<int,int>::Snapshot before = c.snapshot();
+  c.add(5000, 1);
+  ASSERT_EQ(false, c.remove(6000));
+  int v;
+  ASSERT_EQ(false, before -> find(5000, v));
+  ASSERT_EQ(true, c.find(5000, v));
+  ASSERT_EQ(1000, before -> size());
+  ASSERT_EQ(1001, c.size());
+}
+
+TEST(PersistentTest, OldVersionsStayValid)
+{
+  PersistentAVLCollection<int,int> c;
+  for(int i = 0; i < 1000; ++i)
+    c.add(i * 7 % 1000, i);
+  PersistentAVLCollection<int,int> v1 = c.snapshot();
+  for(int i = 0; i < 500; ++i)
+    ASSERT_EQ(true, c.remove(i));
+  ASSERT_EQ(false, c.remove(0));
+  c.add(5000, 1);
+  PersistentAVLCollection<int,int> v2 = c.snapshot();
+  c.add(6000, 2);
+  ASSERT_EQ(1000, v1.size());
+  ASSERT_EQ(501, v2.size());
+  ASSERT_EQ(502, c.size());
+  int v;
+  ASSERT_EQ(true, v1.find(10, v));
+  ASSERT_EQ(false, v2.find(10, v));
+  ASSERT_EQ(false, v2.find(6000, v));
+  ASSERT_EQ(true, c.find(6000, v));
+  ASSERT_LE(v1.height(), 11);
+  ASSERT_LE(c.height(), 10);
+  vector<int> ks;
+  v1.sort(ks);
+  ASSERT_EQ(1000, ks.size());
+  for(int i = 0; i < 1000; ++i)
+    ASSERT_EQ(i, ks[i]);
+  vector<int> vs;
+  c.find(498, 502, vs);
+  ASSERT_EQ(3, vs.size());
+  // the comparator orders the tree and its ranges
+  PersistentAVLCollection<int,int,Descending> d;
+  for(int i = 0; i < 100; ++i)
+    d.add(i, i);
+  ks.clear();
+  d.sort(ks);
+  ASSERT_EQ(99, ks[0]);
+  ASSERT_EQ(0, ks[99]);
+  vs.clear();
+  d.find(60, 50, vs);
+  ASSERT_EQ(11, vs.size());
+  ASSERT_EQ(60, vs[0]);
+  ASSERT_EQ(true, d.remove(55));
+  ASSERT_EQ(false, d.find(55, v));
+}
+
 int main(int argc, char** argv)
 {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,73 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   bench.cpp
+// Description:
+//            Replays a trace file (text or binary, see
+//            trace_loader.h) on the AVL tree collection with the
+//            benchmark harness (see bench_harness.h) and writes the
+//            latency and throughput results as JSON or CSV. With
+//            --save-binary the trace is converted to the binary
+//            format instead.
+//
+//            usage: avlBench trace [--warmup N] [--repeats N] [--csv]
+//                                  [--save-binary FILE]
+//
+//----------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include "avl_collection.h"
+#include "trace_loader.h"
+#include "bench_harness.h"
+
+using namespace std;
+
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    cout << "usage: " << argv[0]
+         << " trace [--warmup N] [--repeats N] [--csv] [--save-binary FILE]" << endl;
+    return 1;
+  }
+  BenchOptions options;
+  bool csv = false;
+  string binary_file;
+  for (int i = 2; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--warmup" && i + 1 < argc)
+      options.warmup = stoi(argv[++i]);
+    else if (arg == "--repeats" && i + 1 < argc)
+      options.repeats = stoi(argv[++i]);
+    else if (arg == "--csv")
+      csv = true;
+    else if (arg == "--save-binary" && i + 1 < argc)
+      binary_file = argv[++i];
+    else {
+      cerr << "unknown option: " << arg << endl;
+      return 1;
+    }
+  }
+
+  Trace trace;
+  if (!trace.load(argv[1])) {
+    cerr << "cannot read " << argv[1] << endl;
+    return 1;
+  }
+  if (!binary_file.empty()) {
+    if (!trace.save_binary(binary_file)) {
+      cerr << "cannot write " << binary_file << endl;
+      return 1;
+    }
+    return 0;
+  }
+  BenchHarness<string,double> harness("AVLCollection", trace, options);
+  harness.run([] { return make_unique<AVLCollection<string,double>>(); });
+  if (csv)
+    harness.write_csv(cout, true);
+  else
+    harness.write_json(cout);
+  return 0;
+}
@@ -0,0 +1,468 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   bench_harness.h
+// Description:
+//            Nanosecond-resolution benchmark harness for key-value
+//            collections. A pre-parsed trace (see trace_loader.h) is
+//            turned into one key object per distinct key before
+//            anything is timed. Each run replays it on a fresh
+//            collection: warmup runs are discarded, then every
+//            repeat replays the trace twice, once timing each op
+//            (for latencies) and once timing only the whole replay
+//            (for throughput, without the clock reads).
+//
+//            Op latencies are read from the time-stamp counter on
+//            x86 (converted to nanoseconds with a rate calibrated
+//            against steady_clock) and from steady_clock elsewhere,
+//            less the cost of reading the clock. Results are kept per
+//            op type as min/median/p99/p999/max/mean plus a log2
+//            histogram, and can be written as JSON or CSV. Range and
+//            sort ops can be skipped, for collections without a key
+//            order.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <ostream>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <cstdint>
+#include <type_traits>
+#include "collection.h"
+#include "trace_loader.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+// a trace key as a K: built from the characters if K allows it,
+// otherwise read with >> (e.g. numeric keys)
+template<typename K>
+K trace_key(std::string_view chars);
+
+
+// nanosecond clock: the time-stamp counter where there is one
+class BenchClock
+{
+public:
+
+  // calibrate the counter rate and the cost of a reading
+  BenchClock();
+
+  // current counter value
+  static std::uint64_t ticks();
+
+  // counter ticks to nanoseconds, less the reading overhead
+  double elapsed_ns(std::uint64_t start, std::uint64_t end) const;
+
+  // nanoseconds per tick and ticks spent per reading
+  double ns_per_tick() const;
+  double overhead_ticks() const;
+
+private:
+  double tick_ns;
+  double overhead;
+};
+
+
+// replay settings
+struct BenchOptions {
+  // discarded runs before measuring
+  int warmup = 1;
+
+  // measured runs, each on a fresh collection
+  int repeats = 5;
+
+  // replay only adds, removes and finds
+  bool point_ops_only = false;
+};
+
+
+// latency distribution of one op type, in nanoseconds
+struct LatencySummary {
+  long count = 0;
+  double min = 0;
+  double median = 0;
+  double p99 = 0;
+  double p999 = 0;
+  double max = 0;
+  double mean = 0;
+  // histogram[i] counts latencies in [2^i, 2^(i+1)) ns (bucket 0 also
+  // takes anything below 1 ns)
+  std::vector<long> histogram;
+};
+
+
+template<typename K, typename V>
+class BenchHarness
+{
+public:
+
+  // benchmark a trace (kept by reference) under a name used in the
+  // reports
+  BenchHarness(const std::string& name, const Trace& trace,
+               const BenchOptions& options = BenchOptions());
+
+  // run the warmup and measured replays on collections returned by
+  // make() (anything convertible to std::unique_ptr<Collection<K,V>>)
+  template<typename Make>
+  void run(Make make);
+
+  // replay the trace once, untimed (e.g. to inspect the collection it
+  // leaves behind)
+  void replay(Collection<K,V>& coll);
+
+  // number of ops each replay performs
+  std::size_t replayed_ops() const;
+
+  // latencies of one op type over all measured runs
+  LatencySummary summary(TraceOpType type) const;
+
+  // median throughput of the untimed replays, in ops per second
+  double throughput() const;
+
+  // the name given to the harness
+  const std::string& name() const;
+
+  // write the results as one JSON object
+  void write_json(std::ostream& out) const;
+
+  // write one CSV row per op type, after a header row if requested
+  void write_csv(std::ostream& out, bool header) const;
+
+private:
+
+  // replay every op, adding each one's latency to latencies[type] if
+  // latencies isn't null
+  void replay(Collection<K,V>& coll, std::vector<double>* latencies);
+
+  // true if the options skip ops of this type
+  bool skipped(TraceOpType type) const;
+
+  // value at quantile q of sorted samples
+  static double quantile(const std::vector<double>& sorted, double q);
+
+  std::string bench_name;
+  const Trace& trace;
+
+  // the trace's interned keys as K, by key index
+  std::vector<K> keys;
+
+  BenchOptions options;
+  BenchClock clock;
+
+  // ops not skipped by the options
+  std::size_t op_total;
+
+  // latency samples per op type, in ns
+  std::vector<double> samples[trace_op_types];
+
+  // ops per second of each untimed replay
+  std::vector<double> rates;
+};
+
+
+//------------------------------------------------------------------------------
+// Trace Keys
+//------------------------------------------------------------------------------
+
+
+template<typename K>
+K trace_key(std::string_view chars)
+{
+  if constexpr (std::is_constructible_v<K, std::string_view>)
+    return K(chars);
+  else {
+    K key{};
+    std::istringstream(std::string(chars)) >> key;
+    return key;
+  }
+}
+
+
+//------------------------------------------------------------------------------
+// BenchClock
+//------------------------------------------------------------------------------
+
+
+// counts ticks over a 20 ms steady_clock interval, and takes the
+// smallest gap between two back-to-back readings as the overhead
+inline BenchClock::BenchClock()
+{
+  using namespace std::chrono;
+  auto wall_start = steady_clock::now();
+  std::uint64_t tick_start = ticks();
+  while(steady_clock::now() - wall_start < milliseconds(20))
+    ;
+  std::uint64_t tick_end = ticks();
+  auto wall = duration_cast<nanoseconds>(steady_clock::now() - wall_start).count();
+  tick_ns = double(wall) / double(tick_end - tick_start);
+
+  overhead = 1e18;
+  for(int i = 0; i < 1000; ++i)
+  {
+    std::uint64_t start = ticks();
+    std::uint64_t end = ticks();
+    overhead = std::min(overhead, double(end - start));
+  }
+}
+
+
+// rdtscp waits for earlier instructions to finish before reading
+inline std::uint64_t BenchClock::ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int aux;
+  return __rdtscp(&aux);
+#else
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+inline double BenchClock::elapsed_ns(std::uint64_t start, std::uint64_t end) const
+{
+  return std::max(0.0, double(end - start) - overhead) * tick_ns;
+}
+
+
+inline double BenchClock::ns_per_tick() const
+{
+  return tick_ns;
+}
+
+
+inline double BenchClock::overhead_ticks() const
+{
+  return overhead;
+}
+
+
+//------------------------------------------------------------------------------
+// BenchHarness
+//------------------------------------------------------------------------------
+
+
+// converts each distinct key once, so replays only index the keys
+template<typename K, typename V>
+BenchHarness<K,V>::BenchHarness(const std::string& name, const Trace& trace,
+                                const BenchOptions& options)
+  : bench_name(name), trace(trace), options(options), op_total(0)
+{
+  keys.reserve(trace.key_count());
+  for(std::size_t i = 0; i < trace.key_count(); ++i)
+    keys.push_back(trace_key<K>(trace.key(i)));
+  for(const TraceOp& op : trace)
+    op_total += !skipped(op.type);
+}
+
+
+// each repeat gets two fresh collections: one for the timed ops and
+// one for the untimed throughput replay
+template<typename K, typename V>
+template<typename Make>
+void BenchHarness<K,V>::run(Make make)
+{
+  using namespace std::chrono;
+  for(int i = 0; i < options.warmup; ++i)
+  {
+    std::unique_ptr<Collection<K,V>> coll(make());
+    replay(*coll, nullptr);
+  }
+  for(int i = 0; i < options.repeats; ++i)
+  {
+    std::unique_ptr<Collection<K,V>> timed(make());
+    replay(*timed, samples);
+    timed.reset();
+
+    std::unique_ptr<Collection<K,V>> untimed(make());
+    auto start = steady_clock::now();
+    replay(*untimed, nullptr);
+    auto wall = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+    rates.push_back(wall > 0 ? op_total * 1e9 / wall : 0);
+  }
+}
+
+
+template<typename K, typename V>
+void BenchHarness<K,V>::replay(Collection<K,V>& coll)
+{
+  replay(coll, nullptr);
+}
+
+
+template<typename K, typename V>
+std::size_t BenchHarness<K,V>::replayed_ops() const
+{
+  return op_total;
+}
+
+
+// percentiles come from the sorted samples; the histogram buckets by
+// powers of two
+template<typename K, typename V>
+LatencySummary BenchHarness<K,V>::summary(TraceOpType type) const
+{
+  LatencySummary result;
+  std::vector<double> sorted = samples[int(type)];
+  if(sorted.empty())
+    return result;
+  std::sort(sorted.begin(), sorted.end());
+  double total = 0;
+  for(double ns : sorted)
+  {
+    total += ns;
+    std::size_t bucket = 0;
+    while(bucket < 63 && double(std::uint64_t(2) << bucket) <= ns)
+      bucket++;
+    if(result.histogram.size() <= bucket)
+      result.histogram.resize(bucket + 1);
+    result.histogram[bucket]++;
+  }
+  result.count = sorted.size();
+  result.min = sorted.front();
+  result.median = quantile(sorted, 0.5);
+  result.p99 = quantile(sorted, 0.99);
+  result.p999 = quantile(sorted, 0.999);
+  result.max = sorted.back();
+  result.mean = total / sorted.size();
+  return result;
+}
+
+
+template<typename K, typename V>
+double BenchHarness<K,V>::throughput() const
+{
+  if(rates.empty())
+    return 0;
+  std::vector<double> sorted = rates;
+  std::sort(sorted.begin(), sorted.end());
+  return quantile(sorted, 0.5);
+}
+
+
+template<typename K, typename V>
+const std::string& BenchHarness<K,V>::name() const
+{
+  return bench_name;
+}
+
+
+// {"name": ..., "repeats": ..., "throughput_ops_per_s": ...,
+//  "ops": {"add": {"count": ..., ..., "histogram_log2_ns": [...]}, ...}}
+template<typename K, typename V>
+void BenchHarness<K,V>::write_json(std::ostream& out) const
+{
+  out << "{\"name\": \"" << bench_name << "\", \"trace_ops\": " << trace.size()
+      << ", \"replayed_ops\": " << op_total
+      << ", \"warmup\": " << options.warmup << ", \"repeats\": " << options.repeats
+      << ", \"throughput_ops_per_s\": " << long(throughput())
+      << ", \"ns_per_tick\": " << clock.ns_per_tick() << ", \"ops\": {";
+  bool first = true;
+  for(int i = 0; i < trace_op_types; ++i)
+  {
+    LatencySummary s = summary(TraceOpType(i));
+    if(s.count == 0)
+      continue;
+    out << (first ? "" : ", ") << "\"" << trace_op_names[i] << "\": {\"count\": " << s.count
+        << ", \"min_ns\": " << s.min << ", \"median_ns\": " << s.median
+        << ", \"p99_ns\": " << s.p99 << ", \"p999_ns\": " << s.p999
+        << ", \"max_ns\": " << s.max << ", \"mean_ns\": " << s.mean
+        << ", \"histogram_log2_ns\": [";
+    for(std::size_t b = 0; b < s.histogram.size(); ++b)
+      out << (b ? ", " : "") << s.histogram[b];
+    out << "]}";
+    first = false;
+  }
+  out << "}}" << std::endl;
+}
+
+
+template<typename K, typename V>
+void BenchHarness<K,V>::write_csv(std::ostream& out, bool header) const
+{
+  if(header)
+    out << "name,op,count,min_ns,median_ns,p99_ns,p999_ns,max_ns,mean_ns,throughput_ops_per_s"
+        << std::endl;
+  for(int i = 0; i < trace_op_types; ++i)
+  {
+    LatencySummary s = summary(TraceOpType(i));
+    if(s.count == 0)
+      continue;
+    out << bench_name << "," << trace_op_names[i] << "," << s.count << "," << s.min << ","
+        << s.median << "," << s.p99 << "," << s.p999 << "," << s.max << "," << s.mean << ","
+        << long(throughput()) << std::endl;
+  }
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+// the results of range and sort go into vectors created outside the
+// timed region
+template<typename K, typename V>
+void BenchHarness<K,V>::replay(Collection<K,V>& coll, std::vector<double>* latencies)
+{
+  V found;
+  std::vector<V> vals;
+  std::vector<K> sorted_keys;
+  for(const TraceOp& op : trace)
+  {
+    if(skipped(op.type))
+      continue;
+    vals.clear();
+    sorted_keys.clear();
+    std::uint64_t start = latencies ? BenchClock::ticks() : 0;
+    switch(op.type)
+    {
+    case TraceOpType::add:
+      coll.add(keys[op.key1], V(op.val));
+      break;
+    case TraceOpType::remove:
+      coll.remove(keys[op.key1]);
+      break;
+    case TraceOpType::find:
+      coll.find(keys[op.key1], found);
+      break;
+    case TraceOpType::range:
+      coll.find(keys[op.key1], keys[op.key2], vals);
+      break;
+    case TraceOpType::sort:
+      coll.sort(sorted_keys);
+      break;
+    }
+    if(latencies)
+      latencies[int(op.type)].push_back(clock.elapsed_ns(start, BenchClock::ticks()));
+  }
+}
+
+
+template<typename K, typename V>
+bool BenchHarness<K,V>::skipped(TraceOpType type) const
+{
+  return options.point_ops_only && (type == TraceOpType::range || type == TraceOpType::sort);
+}
+
+
+// nearest-rank quantile
+template<typename K, typename V>
+double BenchHarness<K,V>::quantile(const std::vector<double>& sorted, double q)
+{
+  std::size_t rank = std::size_t(q * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+
+#endif
@@ -0,0 +1,664 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   btree_collection.h
+// Description:
+//            A B-tree key-value pair collection with wide nodes. Each
+//            node holds as many keys as fit in two cache lines (at
+//            least three), so a lookup takes one or two cache misses
+//            per level instead of one per comparison. For 32- and
+//            64-bit integer keys and FixedKey<N <= 8> keys under the
+//            default comparison, the keys of a node are searched
+//            with SSE2/AVX2 vector compares (all keys at once, no
+//            branches); other keys are scanned one by one. 64-bit
+//            lanes need SSE4.2 or AVX2, which a default build doesn't
+//            target: configure with -DAVL_NATIVE=ON (-march=native) or
+//            64-bit and FixedKey keys fall back to the scan.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef BTREE_COLLECTION_H
+#define BTREE_COLLECTION_H
+
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "collection.h"
+#include "avl_collection.h"
+#include "slab_allocator.h"
+#include "fixed_key.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+// how a key type maps onto vector lanes: lane_bits is 32 or 64 (0 if
+// the key can't be searched with vector compares), and flip is xored
+// into every lane so that unsigned lanes order correctly under the
+// signed vector compares
+template<typename K>
+struct BTreeKeyLanes
+{
+  static const int lane_bits = 0;
+  static const std::uint64_t flip = 0;
+};
+
+
+template<typename K>
+  requires (std::is_integral_v<K> && (sizeof(K) == 4 || sizeof(K) == 8))
+struct BTreeKeyLanes<K>
+{
+  static const int lane_bits = 8 * sizeof(K);
+  static const std::uint64_t flip =
+    std::is_signed_v<K> ? 0 : std::uint64_t(1) << (lane_bits - 1);
+};
+
+
+// a FixedKey of up to 8 characters is one big-endian packed word
+template<std::size_t N>
+  requires (N <= 8)
+struct BTreeKeyLanes<FixedKey<N>>
+{
+  static const int lane_bits = 64;
+  static const std::uint64_t flip = std::uint64_t(1) << 63;
+};
+
+
+template<typename K, typename V, typename Compare = ThreeWayCompare>
+class BTreeCollection : public Collection<K,V>
+{
+public:
+
+  // create an empty tree
+  BTreeCollection();
+
+  // trees own their nodes and are not copied
+  BTreeCollection(const BTreeCollection<K,V,Compare>& rhs) = delete;
+  BTreeCollection<K,V,Compare>& operator=(const BTreeCollection<K,V,Compare>& rhs) = delete;
+
+  // delete a tree
+  ~BTreeCollection();
+
+  // add a new key-value pair into the collection
+  void add(const K& a_key, const V& a_val);
+
+  // remove a key-value pair from the collection
+  bool remove(const K& a_key);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+  // return the height of the tree (all leaves are at the same depth)
+  int height() const;
+
+private:
+
+  // key slots per node: two cache lines' worth, at least four (the
+  // last slot is only ever read, by the vector search)
+  static const int key_slots = 128 / sizeof(K) >= 4 ? 128 / sizeof(K) : 4;
+
+  // minimum degree: every node but the root has t-1 to 2t-1 keys
+  static const int t = key_slots / 2;
+  static const int max_keys = 2 * t - 1;
+
+  // vector search is used for lane-sized keys under the default order
+  static constexpr bool simd_keys =
+    BTreeKeyLanes<K>::lane_bits != 0 && std::is_same_v<Compare, ThreeWayCompare>;
+
+  // b-tree node, children are only used by internal nodes (and sit
+  // next to the keys, since a search reads both)
+  struct Node {
+    int n = 0;
+    bool leaf = true;
+    K keys[key_slots];
+    Node* children[key_slots + 1];
+    V values[key_slots];
+  };
+
+  // allocate and construct an empty node
+  Node* create_node(bool leaf);
+
+  // destroy a node and return its storage to the allocator
+  void destroy_node(Node* node);
+
+  // helper to empty entire tree
+  void make_empty(Node* subtree_root);
+
+  // number of keys in the node less than key (scalar or vector search)
+  int rank(const Node* node, const K& key) const;
+
+  // vector version of rank
+  int simd_rank(const Node* node, const K& key) const;
+
+  // split the full child i of node into two, moving its middle key up
+  void split_child(Node* node, int i);
+
+  // add into a subtree whose root is not full
+  void add_nonfull(Node* node, const K& a_key, const V& a_val);
+
+  // recursive remove helper, the node has at least t keys (or is the
+  // root)
+  bool remove(Node* node, const K& key);
+
+  // move the largest (smallest) pair of a subtree out into key and val
+  void remove_max(Node* node, K& key, V& val);
+  void remove_min(Node* node, K& key, V& val);
+
+  // make sure child i of node has at least t keys, returns the index
+  // the child ended up at
+  int fill(Node* node, int i);
+
+  // move a key through the parent from the left (right) sibling of
+  // child i into child i
+  void borrow_from_prev(Node* node, int i);
+  void borrow_from_next(Node* node, int i);
+
+  // merge child i+1 and the key between them into child i
+  void merge(Node* node, int i);
+
+  // helper to build sorted list of keys (used by keys and sort)
+  void inorder(const Node* subtree_root, std::vector<K>& keys) const;
+
+  // helper to recursively find range of values
+  void range_search(const Node* subtree_root, const K& k1, const K& k2,
+                    std::vector<V>& vals) const;
+
+  // number of k-v pairs in the collection
+  int tree_size;
+
+  // root node of tree
+  Node* root;
+
+  // node storage
+  SlabAllocator<Node> node_alloc;
+
+  // three-way key comparison
+  Compare compare;
+};
+
+
+// constructs an empty tree
+template<typename K, typename V, typename Compare>
+BTreeCollection<K,V,Compare>::BTreeCollection()
+  : tree_size(0), root(nullptr)
+{
+}
+
+
+template<typename K, typename V, typename Compare>
+BTreeCollection<K,V,Compare>::~BTreeCollection()
+{
+  make_empty(root);
+}
+
+
+// splits a full root first, which is the only way the tree grows
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::add(const K& a_key, const V& a_val)
+{
+  if(root == nullptr)
+    root = create_node(true);
+  if(root -> n == max_keys)
+  {
+    Node* new_root = create_node(false);
+    new_root -> children[0] = root;
+    root = new_root;
+    split_child(root, 0);
+  }
+  add_nonfull(root, a_key, a_val);
+  tree_size++;
+}
+
+
+// drops an emptied root, which is the only way the tree shrinks
+template<typename K, typename V, typename Compare>
+bool BTreeCollection<K,V,Compare>::remove(const K& a_key)
+{
+  if(root == nullptr)
+    return false;
+  bool removed = remove(root, a_key);
+  if(root -> n == 0)
+  {
+    Node* old_root = root;
+    root = root -> leaf ? nullptr : root -> children[0];
+    destroy_node(old_root);
+  }
+  if(removed)
+    tree_size--;
+  return removed;
+}
+
+
+template<typename K, typename V, typename Compare>
+bool BTreeCollection<K,V,Compare>::find(const K& search_key, V& the_val) const
+{
+  const Node* cur = root;
+  while(cur != nullptr)
+  {
+    int i = rank(cur, search_key);
+    if(i < cur -> n && compare(search_key, cur -> keys[i]) == 0)
+    {
+      the_val = cur -> values[i];
+      return true;
+    }
+    cur = cur -> leaf ? nullptr : cur -> children[i];
+  }
+  return false;
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  range_search(root, k1, k2, vals);
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::keys(std::vector<K>& all_keys) const
+{
+  inorder(root, all_keys);
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::sort(std::vector<K>& all_keys_sorted) const
+{
+  keys(all_keys_sorted);
+}
+
+
+template<typename K, typename V, typename Compare>
+int BTreeCollection<K,V,Compare>::size() const
+{
+  return tree_size;
+}
+
+
+template<typename K, typename V, typename Compare>
+int BTreeCollection<K,V,Compare>::height() const
+{
+  int h = 0;
+  for(const Node* cur = root; cur != nullptr; cur = cur -> leaf ? nullptr : cur -> children[0])
+    h++;
+  return h;
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V, typename Compare>
+typename BTreeCollection<K,V,Compare>::Node*
+BTreeCollection<K,V,Compare>::create_node(bool leaf)
+{
+  Node* node = new (node_alloc.allocate()) Node();
+  node -> leaf = leaf;
+  return node;
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::destroy_node(Node* node)
+{
+  node -> ~Node();
+  node_alloc.deallocate(node);
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::make_empty(Node* subtree_root)
+{
+  if(subtree_root == nullptr)
+    return;
+  if(!subtree_root -> leaf)
+    for(int i = 0; i <= subtree_root -> n; ++i)
+      make_empty(subtree_root -> children[i]);
+  destroy_node(subtree_root);
+}
+
+
+// keys are sorted, so the count of smaller keys is the first position
+// with a key >= key
+template<typename K, typename V, typename Compare>
+int BTreeCollection<K,V,Compare>::rank(const Node* node, const K& key) const
+{
+  if constexpr (simd_keys)
+    return simd_rank(node, key);
+  int i = 0;
+  while(i < node -> n && compare(node -> keys[i], key) < 0)
+    i++;
+  return i;
+}
+
+
+// compares the key against every slot at once and counts the hits
+// among the node's n keys; falls back to a scan where the needed
+// instructions aren't available
+template<typename K, typename V, typename Compare>
+int BTreeCollection<K,V,Compare>::simd_rank(const Node* node, const K& key) const
+{
+  const int lane_bits = BTreeKeyLanes<K>::lane_bits;
+  std::uint64_t less = 0;
+#if defined(__AVX2__)
+  if constexpr (lane_bits == 32)
+  {
+    std::uint32_t word;
+    std::memcpy(&word, &key, sizeof(word));
+    __m256i flip = _mm256_set1_epi32(std::uint32_t(BTreeKeyLanes<K>::flip));
+    __m256i needle = _mm256_xor_si256(_mm256_set1_epi32(word), flip);
+    for(int j = 0; j < key_slots; j += 8)
+    {
+      __m256i lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(node -> keys + j));
+      __m256i hits = _mm256_cmpgt_epi32(needle, _mm256_xor_si256(lanes, flip));
+      less |= std::uint64_t(_mm256_movemask_ps(_mm256_castsi256_ps(hits))) << j;
+    }
+  } else {
+    std::uint64_t word;
+    std::memcpy(&word, &key, sizeof(word));
+    __m256i flip = _mm256_set1_epi64x(BTreeKeyLanes<K>::flip);
+    __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(word), flip);
+    for(int j = 0; j < key_slots; j += 4)
+    {
+      __m256i lanes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(node -> keys + j));
+      __m256i hits = _mm256_cmpgt_epi64(needle, _mm256_xor_si256(lanes, flip));
+      less |= std::uint64_t(_mm256_movemask_pd(_mm256_castsi256_pd(hits))) << j;
+    }
+  }
+#elif defined(__SSE2__)
+  if constexpr (lane_bits == 32)
+  {
+    std::uint32_t word;
+    std::memcpy(&word, &key, sizeof(word));
+    __m128i flip = _mm_set1_epi32(std::uint32_t(BTreeKeyLanes<K>::flip));
+    __m128i needle = _mm_xor_si128(_mm_set1_epi32(word), flip);
+    for(int j = 0; j < key_slots; j += 4)
+    {
+      __m128i lanes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(node -> keys + j));
+      __m128i hits = _mm_cmpgt_epi32(needle, _mm_xor_si128(lanes, flip));
+      less |= std::uint64_t(_mm_movemask_ps(_mm_castsi128_ps(hits))) << j;
+    }
+  } else {
+#if defined(__SSE4_2__)
+    std::uint64_t word;
+    std::memcpy(&word, &key, sizeof(word));
+    __m128i flip = _mm_set1_epi64x(BTreeKeyLanes<K>::flip);
+    __m128i needle = _mm_xor_si128(_mm_set1_epi64x(word), flip);
+    for(int j = 0; j < key_slots; j += 2)
+    {
+      __m128i lanes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(node -> keys + j));
+      __m128i hits = _mm_cmpgt_epi64(needle, _mm_xor_si128(lanes, flip));
+      less |= std::uint64_t(_mm_movemask_pd(_mm_castsi128_pd(hits))) << j;
+    }
+#else
+    int i = 0;
+    while(i < node -> n && compare(node -> keys[i], key) < 0)
+      i++;
+    return i;
+#endif
+  }
+#else
+  int i = 0;
+  while(i < node -> n && compare(node -> keys[i], key) < 0)
+    i++;
+  return i;
+#endif
+  return std::popcount(less & ((std::uint64_t(1) << node -> n) - 1));
+}
+
+
+// the left half stays in the child, the right half moves to a new
+// sibling and the middle key moves up into node at position i
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::split_child(Node* node, int i)
+{
+  Node* full = node -> children[i];
+  Node* sibling = create_node(full -> leaf);
+  sibling -> n = t - 1;
+  std::move(full -> keys + t, full -> keys + max_keys, sibling -> keys);
+  std::move(full -> values + t, full -> values + max_keys, sibling -> values);
+  if(!full -> leaf)
+    std::copy(full -> children + t, full -> children + max_keys + 1, sibling -> children);
+  full -> n = t - 1;
+
+  std::copy_backward(node -> children + i + 1, node -> children + node -> n + 1,
+                     node -> children + node -> n + 2);
+  node -> children[i + 1] = sibling;
+  std::move_backward(node -> keys + i, node -> keys + node -> n, node -> keys + node -> n + 1);
+  std::move_backward(node -> values + i, node -> values + node -> n,
+                     node -> values + node -> n + 1);
+  node -> keys[i] = std::move(full -> keys[t - 1]);
+  node -> values[i] = std::move(full -> values[t - 1]);
+  node -> n++;
+}
+
+
+// splits full children on the way down so there is always room to
+// push a middle key up
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::add_nonfull(Node* node, const K& a_key, const V& a_val)
+{
+  while(!node -> leaf)
+  {
+    int i = rank(node, a_key);
+    if(node -> children[i] -> n == max_keys)
+    {
+      split_child(node, i);
+      if(compare(node -> keys[i], a_key) < 0)
+        i++;
+    }
+    node = node -> children[i];
+  }
+  int i = rank(node, a_key);
+  std::move_backward(node -> keys + i, node -> keys + node -> n, node -> keys + node -> n + 1);
+  std::move_backward(node -> values + i, node -> values + node -> n,
+                     node -> values + node -> n + 1);
+  node -> keys[i] = a_key;
+  node -> values[i] = a_val;
+  node -> n++;
+}
+
+
+// tops up each child before descending into it so that taking a key
+// out of a leaf never leaves it under-full
+template<typename K, typename V, typename Compare>
+bool BTreeCollection<K,V,Compare>::remove(Node* node, const K& key)
+{
+  int i = rank(node, key);
+  if(i < node -> n && compare(key, node -> keys[i]) == 0)
+  {
+    if(node -> leaf)
+    {
+      std::move(node -> keys + i + 1, node -> keys + node -> n, node -> keys + i);
+      std::move(node -> values + i + 1, node -> values + node -> n, node -> values + i);
+      node -> n--;
+      return true;
+    }
+
+    // replace the key with its predecessor or successor, or merge the
+    // two children around it and remove from the merged child
+    if(node -> children[i] -> n >= t)
+      remove_max(node -> children[i], node -> keys[i], node -> values[i]);
+    else if(node -> children[i + 1] -> n >= t)
+      remove_min(node -> children[i + 1], node -> keys[i], node -> values[i]);
+    else {
+      merge(node, i);
+      return remove(node -> children[i], key);
+    }
+    return true;
+  }
+  if(node -> leaf)
+    return false;
+  i = fill(node, i);
+  return remove(node -> children[i], key);
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::remove_max(Node* node, K& key, V& val)
+{
+  while(!node -> leaf)
+    node = node -> children[fill(node, node -> n)];
+  key = std::move(node -> keys[node -> n - 1]);
+  val = std::move(node -> values[node -> n - 1]);
+  node -> n--;
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::remove_min(Node* node, K& key, V& val)
+{
+  while(!node -> leaf)
+    node = node -> children[fill(node, 0)];
+  key = std::move(node -> keys[0]);
+  val = std::move(node -> values[0]);
+  std::move(node -> keys + 1, node -> keys + node -> n, node -> keys);
+  std::move(node -> values + 1, node -> values + node -> n, node -> values);
+  node -> n--;
+}
+
+
+template<typename K, typename V, typename Compare>
+int BTreeCollection<K,V,Compare>::fill(Node* node, int i)
+{
+  if(node -> children[i] -> n >= t)
+    return i;
+  if(i > 0 && node -> children[i - 1] -> n >= t)
+    borrow_from_prev(node, i);
+  else if(i < node -> n && node -> children[i + 1] -> n >= t)
+    borrow_from_next(node, i);
+  else if(i < node -> n)
+    merge(node, i);
+  else {
+    merge(node, i - 1);
+    i--;
+  }
+  return i;
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::borrow_from_prev(Node* node, int i)
+{
+  Node* child = node -> children[i];
+  Node* sibling = node -> children[i - 1];
+  std::move_backward(child -> keys, child -> keys + child -> n, child -> keys + child -> n + 1);
+  std::move_backward(child -> values, child -> values + child -> n,
+                     child -> values + child -> n + 1);
+  if(!child -> leaf)
+  {
+    std::copy_backward(child -> children, child -> children + child -> n + 1,
+                       child -> children + child -> n + 2);
+    child -> children[0] = sibling -> children[sibling -> n];
+  }
+  child -> keys[0] = std::move(node -> keys[i - 1]);
+  child -> values[0] = std::move(node -> values[i - 1]);
+  node -> keys[i - 1] = std::move(sibling -> keys[sibling -> n - 1]);
+  node -> values[i - 1] = std::move(sibling -> values[sibling -> n - 1]);
+  child -> n++;
+  sibling -> n--;
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::borrow_from_next(Node* node, int i)
+{
+  Node* child = node -> children[i];
+  Node* sibling = node -> children[i + 1];
+  child -> keys[child -> n] = std::move(node -> keys[i]);
+  child -> values[child -> n] = std::move(node -> values[i]);
+  if(!child -> leaf)
+  {
+    child -> children[child -> n + 1] = sibling -> children[0];
+    std::copy(sibling -> children + 1, sibling -> children + sibling -> n + 1,
+              sibling -> children);
+  }
+  node -> keys[i] = std::move(sibling -> keys[0]);
+  node -> values[i] = std::move(sibling -> values[0]);
+  std::move(sibling -> keys + 1, sibling -> keys + sibling -> n, sibling -> keys);
+  std::move(sibling -> values + 1, sibling -> values + sibling -> n, sibling -> values);
+  child -> n++;
+  sibling -> n--;
+}
+
+
+// both children have t-1 keys, so the merged child has 2t-1
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::merge(Node* node, int i)
+{
+  Node* child = node -> children[i];
+  Node* sibling = node -> children[i + 1];
+  child -> keys[child -> n] = std::move(node -> keys[i]);
+  child -> values[child -> n] = std::move(node -> values[i]);
+  std::move(sibling -> keys, sibling -> keys + sibling -> n, child -> keys + child -> n + 1);
+  std::move(sibling -> values, sibling -> values + sibling -> n,
+            child -> values + child -> n + 1);
+  if(!child -> leaf)
+    std::copy(sibling -> children, sibling -> children + sibling -> n + 1,
+              child -> children + child -> n + 1);
+  child -> n += sibling -> n + 1;
+
+  std::move(node -> keys + i + 1, node -> keys + node -> n, node -> keys + i);
+  std::move(node -> values + i + 1, node -> values + node -> n, node -> values + i);
+  std::copy(node -> children + i + 2, node -> children + node -> n + 1,
+            node -> children + i + 1);
+  node -> n--;
+  destroy_node(sibling);
+}
+
+
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::inorder(const Node* subtree_root, std::vector<K>& keys) const
+{
+  if(subtree_root == nullptr)
+    return;
+  for(int i = 0; i <= subtree_root -> n; ++i)
+  {
+    if(!subtree_root -> leaf)
+      inorder(subtree_root -> children[i], keys);
+    if(i < subtree_root -> n)
+      keys.push_back(subtree_root -> keys[i]);
+  }
+}
+
+
+// starts at the first key >= k1 and stops at the first key > k2
+template<typename K, typename V, typename Compare>
+void BTreeCollection<K,V,Compare>::range_search(const Node* subtree_root, const K& k1,
+                                                const K& k2, std::vector<V>& vals) const
+{
+  if(subtree_root == nullptr)
+    return;
+  for(int i = rank(subtree_root, k1); i <= subtree_root -> n; ++i)
+  {
+    if(!subtree_root -> leaf)
+      range_search(subtree_root -> children[i], k1, k2, vals);
+    if(i == subtree_root -> n || compare(k2, subtree_root -> keys[i]) < 0)
+      return;
+    vals.push_back(subtree_root -> values[i]);
+  }
+}
+
+
+#endif
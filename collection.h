@@ -34,11 +34,15 @@ class Collection
 {
 public:
 
+  // collections are owned and destroyed through this base
+  virtual ~Collection() = default;
+
   // add a new key-value pair into the collection 
   virtual void add(const K& a_key, const V& a_val) = 0;
 
-  // remove a key-value pair from the collectiona
-  virtual void remove(const K& a_key) = 0;
+  // remove a key-value pair from the collection, returns false if
+  // the key wasn't found
+  virtual bool remove(const K& a_key) = 0;
 
   // find and return the value associated with the key
   virtual bool find(const K& search_key, V& the_val) const = 0;
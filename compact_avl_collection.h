@@ -0,0 +1,559 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   compact_avl_collection.h
+// Description:
+//            A memory-compact AVL tree key-value pair collection.
+//            Nodes live in fixed-size chunks of one node array and
+//            link to their children by 31-bit array index instead of
+//            by 64-bit pointer. Instead of a height, each node keeps
+//            a 2-bit balance factor in the spare top bit of each
+//            link (the left bit means "left side taller", the right
+//            bit "right side taller"), so a node is just the key,
+//            the value and two 32-bit words. Removed nodes are
+//            threaded onto a free list and reused by later adds.
+//            Holds at most 2^31 - 1 pairs.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef COMPACT_AVL_COLLECTION_H
+#define COMPACT_AVL_COLLECTION_H
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include "collection.h"
+#include "avl_collection.h"
+
+
+template<typename K, typename V, typename Compare = ThreeWayCompare>
+class CompactAVLCollection : public Collection<K,V>
+{
+public:
+
+  // create an empty tree
+  CompactAVLCollection();
+
+  // add a new key-value pair into the collection
+  void add(const K& a_key, const V& a_val);
+
+  // remove a key-value pair from the collection
+  bool remove(const K& a_key);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+  // return the height of the tree
+  int height() const;
+
+  // return the number of bytes used by the collection and its nodes
+  std::size_t memory_bytes() const;
+
+private:
+
+  // index used for "no node"
+  static const std::uint32_t nil = 0x7FFFFFFF;
+
+  // top bit of a link: the subtree on that side is the taller one
+  static const std::uint32_t taller = 0x80000000;
+
+  // nodes per chunk (chunks never move, so nodes never move)
+  static const int chunk_bits = 10;
+  static const std::uint32_t chunk_size = 1u << chunk_bits;
+
+  // avl tree node, linked by index, balance kept in the link bits
+  struct Node {
+    K key;
+    V value;
+    std::uint32_t left_link;
+    std::uint32_t right_link;
+  };
+
+  // the node at an index
+  Node& node(std::uint32_t index);
+  const Node& node(std::uint32_t index) const;
+
+  // child indices (without the balance bits)
+  std::uint32_t left(std::uint32_t index) const;
+  std::uint32_t right(std::uint32_t index) const;
+  void set_left(std::uint32_t index, std::uint32_t child);
+  void set_right(std::uint32_t index, std::uint32_t child);
+
+  // height of the right subtree minus height of the left (-1, 0 or 1)
+  int balance(std::uint32_t index) const;
+  void set_balance(std::uint32_t index, int bal);
+
+  // take a node off the free list (or the end of the array)
+  std::uint32_t create_node(const K& a_key, const V& a_val);
+
+  // put a node on the free list
+  void destroy_node(std::uint32_t index);
+
+  // rotate helpers: a's balance and its child b's balance are passed
+  // in since either may be out of range (+-2) mid-rebalance; the
+  // demoted node's balance is stored and the new root's is returned
+  // in new_bal
+  std::uint32_t rotate_right(std::uint32_t a, int a_bal, int b_bal, int& new_bal);
+  std::uint32_t rotate_left(std::uint32_t a, int a_bal, int b_bal, int& new_bal);
+
+  // rebalance a node whose balance is bal (which may be +-2) and
+  // return the new subtree root
+  std::uint32_t rebalance(std::uint32_t subtree_root, int bal);
+
+  // recursive add helper, sets grew if the subtree got taller
+  std::uint32_t add(std::uint32_t subtree_root, const K& a_key, const V& a_val, bool& grew);
+
+  // helper function to remove a node recursively, sets shrank if the
+  // subtree got shorter
+  std::uint32_t remove(const K& key, std::uint32_t subtree_root, std::uint32_t& removed,
+                       bool& shrank);
+
+  // helper to unlink the leftmost node of a subtree
+  std::uint32_t remove_min(std::uint32_t subtree_root, std::uint32_t& min_node, bool& shrank);
+
+  // rebalance after the left (or right) subtree shrank
+  std::uint32_t left_shrank(std::uint32_t subtree_root, bool& shrank);
+  std::uint32_t right_shrank(std::uint32_t subtree_root, bool& shrank);
+
+  // helper to build sorted list of keys (used by keys and sort)
+  void inorder(std::uint32_t subtree_root, std::vector<K>& keys) const;
+
+  // helper to recursively find range of values
+  void range_search(std::uint32_t subtree_root, const K& k1, const K& k2,
+                    std::vector<V>& vals) const;
+
+  // node storage, each chunk reserved to chunk_size up front
+  std::vector<std::vector<Node>> chunks;
+
+  // head of the list of unused nodes (linked through left_link)
+  std::uint32_t free_list;
+
+  // root node of tree
+  std::uint32_t root;
+
+  // number of k-v pairs in the collection
+  int tree_size;
+
+  // three-way key comparison
+  Compare compare;
+};
+
+
+// constructs an empty tree
+template<typename K, typename V, typename Compare>
+CompactAVLCollection<K,V,Compare>::CompactAVLCollection()
+  : free_list(nil), root(nil), tree_size(0)
+{
+}
+
+
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::add(const K& a_key, const V& a_val)
+{
+  bool grew = false;
+  root = add(root, a_key, a_val, grew);
+}
+
+
+template<typename K, typename V, typename Compare>
+bool CompactAVLCollection<K,V,Compare>::remove(const K& a_key)
+{
+  std::uint32_t removed = nil;
+  bool shrank = false;
+  root = remove(a_key, root, removed, shrank);
+  if(removed == nil)
+    return false;
+  destroy_node(removed);
+  tree_size--;
+  return true;
+}
+
+
+template<typename K, typename V, typename Compare>
+bool CompactAVLCollection<K,V,Compare>::find(const K& search_key, V& the_val) const
+{
+  std::uint32_t cur = root;
+  while(cur != nil)
+  {
+    const Node& cur_node = node(cur);
+    auto order = compare(search_key, cur_node.key);
+    if(order < 0)
+      cur = cur_node.left_link & ~taller;
+    else if(order > 0)
+      cur = cur_node.right_link & ~taller;
+    else {
+      the_val = cur_node.value;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  range_search(root, k1, k2, vals);
+}
+
+
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::keys(std::vector<K>& all_keys) const
+{
+  inorder(root, all_keys);
+}
+
+
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::sort(std::vector<K>& all_keys_sorted) const
+{
+  keys(all_keys_sorted);
+}
+
+
+template<typename K, typename V, typename Compare>
+int CompactAVLCollection<K,V,Compare>::size() const
+{
+  return tree_size;
+}
+
+
+// no heights are stored, so follow the taller side down to a leaf
+template<typename K, typename V, typename Compare>
+int CompactAVLCollection<K,V,Compare>::height() const
+{
+  int h = 0;
+  for(std::uint32_t cur = root; cur != nil; ++h)
+    cur = balance(cur) > 0 ? right(cur) : left(cur);
+  return h;
+}
+
+
+// counts every chunk in full, including unused slots
+template<typename K, typename V, typename Compare>
+std::size_t CompactAVLCollection<K,V,Compare>::memory_bytes() const
+{
+  std::size_t bytes = sizeof(*this) + chunks.capacity() * sizeof(std::vector<Node>);
+  for(const std::vector<Node>& chunk : chunks)
+    bytes += chunk.capacity() * sizeof(Node);
+  return bytes;
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V, typename Compare>
+typename CompactAVLCollection<K,V,Compare>::Node&
+CompactAVLCollection<K,V,Compare>::node(std::uint32_t index)
+{
+  return chunks[index >> chunk_bits][index & (chunk_size - 1)];
+}
+
+
+template<typename K, typename V, typename Compare>
+const typename CompactAVLCollection<K,V,Compare>::Node&
+CompactAVLCollection<K,V,Compare>::node(std::uint32_t index) const
+{
+  return chunks[index >> chunk_bits][index & (chunk_size - 1)];
+}
+
+
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::left(std::uint32_t index) const
+{
+  return node(index).left_link & ~taller;
+}
+
+
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::right(std::uint32_t index) const
+{
+  return node(index).right_link & ~taller;
+}
+
+
+// keeps the balance bit of the link
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::set_left(std::uint32_t index, std::uint32_t child)
+{
+  Node& n = node(index);
+  n.left_link = (n.left_link & taller) | child;
+}
+
+
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::set_right(std::uint32_t index, std::uint32_t child)
+{
+  Node& n = node(index);
+  n.right_link = (n.right_link & taller) | child;
+}
+
+
+template<typename K, typename V, typename Compare>
+int CompactAVLCollection<K,V,Compare>::balance(std::uint32_t index) const
+{
+  const Node& n = node(index);
+  return int(n.right_link >> 31) - int(n.left_link >> 31);
+}
+
+
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::set_balance(std::uint32_t index, int bal)
+{
+  Node& n = node(index);
+  n.left_link = (n.left_link & ~taller) | (bal < 0 ? taller : 0);
+  n.right_link = (n.right_link & ~taller) | (bal > 0 ? taller : 0);
+}
+
+
+// reuses a free node if there is one, otherwise appends to the last
+// chunk (starting a new chunk when it is full)
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::create_node(const K& a_key, const V& a_val)
+{
+  std::uint32_t index = free_list;
+  if(index != nil)
+  {
+    free_list = node(index).left_link;
+    node(index) = Node{a_key, a_val, nil, nil};
+    return index;
+  }
+  if(chunks.empty() || chunks.back().size() == chunk_size)
+  {
+    chunks.emplace_back();
+    chunks.back().reserve(chunk_size);
+  }
+  index = ((chunks.size() - 1) << chunk_bits) | chunks.back().size();
+  chunks.back().push_back(Node{a_key, a_val, nil, nil});
+  return index;
+}
+
+
+// resets the node's pair (releasing what it owns) and frees the slot
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::destroy_node(std::uint32_t index)
+{
+  node(index) = Node{K(), V(), free_list, nil};
+  free_list = index;
+}
+
+
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::rotate_right(std::uint32_t a, int a_bal,
+                                                              int b_bal, int& new_bal)
+{
+  std::uint32_t b = left(a);
+  set_left(a, right(b));
+  set_right(b, a);
+  a_bal = a_bal + 1 - std::min(b_bal, 0);
+  new_bal = b_bal + 1 + std::max(a_bal, 0);
+  set_balance(a, a_bal);
+  return b;
+}
+
+
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::rotate_left(std::uint32_t a, int a_bal,
+                                                             int b_bal, int& new_bal)
+{
+  std::uint32_t b = right(a);
+  set_right(a, left(b));
+  set_left(b, a);
+  a_bal = a_bal - 1 - std::max(b_bal, 0);
+  new_bal = b_bal - 1 + std::min(a_bal, 0);
+  set_balance(a, a_bal);
+  return b;
+}
+
+
+// same cases as AVLCollection::rebalance, decided by balance factors
+// instead of heights
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::rebalance(std::uint32_t subtree_root, int bal)
+{
+  int new_bal = bal;
+
+  // if left heavy (balance is less than -1)
+  if(bal < -1)
+  {
+    std::uint32_t lptr = left(subtree_root);
+    int lbal = balance(lptr);
+
+    // if left-right heavy, double rotate
+    if(lbal > 0)
+      set_left(subtree_root, rotate_left(lptr, lbal, balance(right(lptr)), lbal));
+    subtree_root = rotate_right(subtree_root, bal, lbal, new_bal);
+
+    // if right heavy (balance is greater than 1)
+  } else if(bal > 1)
+  {
+    std::uint32_t rptr = right(subtree_root);
+    int rbal = balance(rptr);
+
+    // if right-left heavy, double rotate
+    if(rbal < 0)
+      set_right(subtree_root, rotate_right(rptr, rbal, balance(left(rptr)), rbal));
+    subtree_root = rotate_left(subtree_root, bal, rbal, new_bal);
+  }
+  set_balance(subtree_root, new_bal);
+  return subtree_root;
+}
+
+
+// creating a node may start a new chunk, but chunks never move, so
+// indices and references stay valid
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::add(std::uint32_t subtree_root,
+                                                     const K& a_key, const V& a_val,
+                                                     bool& grew)
+{
+  if(subtree_root == nil)
+  {
+    tree_size++;
+    grew = true;
+    return create_node(a_key, a_val);
+  }
+  int bal = balance(subtree_root);
+  if(compare(a_key, node(subtree_root).key) < 0)
+  {
+    set_left(subtree_root, add(left(subtree_root), a_key, a_val, grew));
+    if(!grew)
+      return subtree_root;
+    bal--;
+  } else {
+    set_right(subtree_root, add(right(subtree_root), a_key, a_val, grew));
+    if(!grew)
+      return subtree_root;
+    bal++;
+  }
+
+  // the subtree grows only if it was balanced before; a rotation
+  // always brings it back to its old height
+  grew = (bal == -1 || bal == 1);
+  return rebalance(subtree_root, bal);
+}
+
+
+// same single-descent removal as AVLCollection::remove
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::remove(const K& key, std::uint32_t subtree_root,
+                                                        std::uint32_t& removed, bool& shrank)
+{
+  if(subtree_root == nil)
+    return subtree_root;
+
+  auto order = compare(key, node(subtree_root).key);
+  if(order < 0)
+  {
+    set_left(subtree_root, remove(key, left(subtree_root), removed, shrank));
+    return shrank ? left_shrank(subtree_root, shrank) : subtree_root;
+  }
+  if(order > 0)
+  {
+    set_right(subtree_root, remove(key, right(subtree_root), removed, shrank));
+    return shrank ? right_shrank(subtree_root, shrank) : subtree_root;
+  }
+
+  removed = subtree_root;
+  shrank = true;
+  if(left(subtree_root) == nil)
+    return right(subtree_root);
+  if(right(subtree_root) == nil)
+    return left(subtree_root);
+
+  // two children: the inorder successor takes the node's place (and
+  // its balance)
+  std::uint32_t successor = nil;
+  std::uint32_t rest = remove_min(right(subtree_root), successor, shrank);
+  node(successor).left_link = node(subtree_root).left_link;
+  node(successor).right_link = node(subtree_root).right_link;
+  set_right(successor, rest);
+  return shrank ? right_shrank(successor, shrank) : successor;
+}
+
+
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::remove_min(std::uint32_t subtree_root,
+                                                            std::uint32_t& min_node,
+                                                            bool& shrank)
+{
+  if(left(subtree_root) == nil)
+  {
+    min_node = subtree_root;
+    shrank = true;
+    return right(subtree_root);
+  }
+  set_left(subtree_root, remove_min(left(subtree_root), min_node, shrank));
+  return shrank ? left_shrank(subtree_root, shrank) : subtree_root;
+}
+
+
+// the subtree stays shorter unless it was right heavy and a rotation
+// left the new root unbalanced
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::left_shrank(std::uint32_t subtree_root,
+                                                             bool& shrank)
+{
+  subtree_root = rebalance(subtree_root, balance(subtree_root) + 1);
+  shrank = (balance(subtree_root) == 0);
+  return subtree_root;
+}
+
+
+template<typename K, typename V, typename Compare>
+std::uint32_t CompactAVLCollection<K,V,Compare>::right_shrank(std::uint32_t subtree_root,
+                                                              bool& shrank)
+{
+  subtree_root = rebalance(subtree_root, balance(subtree_root) - 1);
+  shrank = (balance(subtree_root) == 0);
+  return subtree_root;
+}
+
+
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::inorder(std::uint32_t subtree_root,
+                                                std::vector<K>& keys) const
+{
+  if(subtree_root == nil)
+    return;
+  inorder(left(subtree_root), keys);
+  keys.push_back(node(subtree_root).key);
+  inorder(right(subtree_root), keys);
+}
+
+
+template<typename K, typename V, typename Compare>
+void CompactAVLCollection<K,V,Compare>::range_search(std::uint32_t subtree_root, const K& k1,
+                                                     const K& k2, std::vector<V>& vals) const
+{
+  if(subtree_root == nil)
+    return;
+  const Node& cur = node(subtree_root);
+  auto order_k1 = compare(k1, cur.key);
+  auto order_k2 = compare(k2, cur.key);
+  if(order_k1 < 0)
+    range_search(left(subtree_root), k1, k2, vals);
+  if(order_k1 <= 0 && order_k2 >= 0)
+    vals.push_back(cur.value);
+  if(order_k2 > 0)
+    range_search(right(subtree_root), k1, k2, vals);
+}
+
+
+#endif
@@ -0,0 +1,206 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   compare.cpp
+// Description:
+//            Replays the same traces (text or binary, see
+//            trace_loader.h) on every Collection implementation and
+//            on standard library baselines (std::map, a red-black
+//            tree, and std::unordered_map, which only replays adds,
+//            removes and finds) with the benchmark harness (see
+//            bench_harness.h), then prints a comparison table of
+//            throughput, per-op latency percentiles, memory footprint
+//            and height. Memory is the heap in use (as counted by the
+//            C library) while holding the collection a replay leaves
+//            behind, so it includes key storage and allocator slack.
+//
+//            usage: avlCompare trace [trace ...] [--warmup N]
+//                                    [--repeats N] [--csv]
+//
+//----------------------------------------------------------------------
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include "avl_collection.h"
+#include "compact_avl_collection.h"
+#include "btree_collection.h"
+#include "std_collections.h"
+#include "trace_loader.h"
+#include "bench_harness.h"
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace std;
+
+
+// results of one implementation on one trace
+struct CompareRow {
+  string name;
+  bool point_ops_only;
+  double throughput;
+  LatencySummary latency[trace_op_types];
+  long heap_bytes;
+  int size;
+  int height;
+};
+
+
+// bytes of heap in use, or -1 if the C library can't tell
+long heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return -1;
+#endif
+}
+
+
+// height of the collection, or -1 if it has none
+template<typename Coll>
+int height_of(const Coll& coll)
+{
+  if constexpr (requires { coll.height(); })
+    return coll.height();
+  else
+    return -1;
+}
+
+
+// benchmarks one implementation, then replays the trace once more on
+// a collection that is kept to measure its footprint and height
+template<typename Coll>
+CompareRow compare(const string& name, const Trace& trace, BenchOptions options,
+                   bool point_ops_only)
+{
+  options.point_ops_only = point_ops_only;
+  BenchHarness<string,double> harness(name, trace, options);
+  harness.run([] { return make_unique<Coll>(); });
+
+  CompareRow row;
+  row.name = name;
+  row.point_ops_only = point_ops_only;
+  row.throughput = harness.throughput();
+  for (int i = 0; i < trace_op_types; ++i)
+    row.latency[i] = harness.summary(TraceOpType(i));
+  long before = heap_in_use();
+  unique_ptr<Coll> coll = make_unique<Coll>();
+  harness.replay(*coll);
+  row.heap_bytes = before < 0 ? -1 : heap_in_use() - before;
+  row.size = coll -> size();
+  row.height = height_of(*coll);
+  return row;
+}
+
+
+// prints a number, or - if it is negative (unknown)
+string known(double value, int precision = 0)
+{
+  if (value < 0)
+    return "-";
+  ostringstream out;
+  out << fixed << setprecision(precision) << value;
+  return out.str();
+}
+
+
+// prints the summary and latency tables of one trace
+void print_table(const string& filename, const Trace& trace, const vector<CompareRow>& rows)
+{
+  cout << "TRACE: " << filename << " (" << trace.size() << " ops, "
+       << trace.key_count() << " keys)" << endl;
+  cout << "==========" << endl << endl;
+  cout << "  " << left << setw(22) << "implementation" << right << setw(14) << "ops/s"
+       << setw(14) << "heap bytes" << setw(12) << "bytes/pair" << setw(8) << "height" << endl;
+  for (const CompareRow& row : rows) {
+    double per_pair = row.heap_bytes >= 0 && row.size > 0 ? double(row.heap_bytes) / row.size : -1;
+    cout << "  " << left << setw(22) << row.name + (row.point_ops_only ? "*" : "") << right
+         << setw(14) << known(row.throughput) << setw(14) << known(row.heap_bytes)
+         << setw(12) << known(per_pair, 1) << setw(8) << known(row.height) << endl;
+  }
+  cout << endl << "  latency (ns)" << setw(26) << "median" << setw(12) << "p99"
+       << setw(12) << "p999" << setw(12) << "max" << endl;
+  for (int i = 0; i < trace_op_types; ++i)
+    for (const CompareRow& row : rows) {
+      const LatencySummary& s = row.latency[i];
+      if (s.count == 0)
+        continue;
+      cout << "  " << left << setw(8) << trace_op_names[i] << setw(22) << row.name << right
+           << setw(8) << known(s.median) << setw(12) << known(s.p99)
+           << setw(12) << known(s.p999) << setw(12) << known(s.max) << endl;
+    }
+  cout << endl << "  * point ops only (range and sort skipped)" << endl << endl;
+}
+
+
+// one row per implementation and op type
+void print_csv(const string& filename, const vector<CompareRow>& rows)
+{
+  for (const CompareRow& row : rows)
+    for (int i = 0; i < trace_op_types; ++i) {
+      const LatencySummary& s = row.latency[i];
+      if (s.count == 0)
+        continue;
+      cout << filename << "," << row.name << "," << trace_op_names[i] << "," << s.count << ","
+           << s.median << "," << s.p99 << "," << s.p999 << "," << s.max << ","
+           << long(row.throughput) << "," << row.heap_bytes << "," << row.size << ","
+           << row.height << endl;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    cout << "usage: " << argv[0] << " trace [trace ...] [--warmup N] [--repeats N] [--csv]"
+         << endl;
+    return 1;
+  }
+  BenchOptions options;
+  bool csv = false;
+  vector<string> filenames;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--warmup" && i + 1 < argc)
+      options.warmup = stoi(argv[++i]);
+    else if (arg == "--repeats" && i + 1 < argc)
+      options.repeats = stoi(argv[++i]);
+    else if (arg == "--csv")
+      csv = true;
+    else if (arg.rfind("--", 0) == 0) {
+      cerr << "unknown option: " << arg << endl;
+      return 1;
+    }
+    else
+      filenames.push_back(arg);
+  }
+
+  if (csv)
+    cout << "trace,name,op,count,median_ns,p99_ns,p999_ns,max_ns,throughput_ops_per_s,"
+         << "heap_bytes,size,height" << endl;
+  for (const string& filename : filenames) {
+    Trace trace;
+    if (!trace.load(filename)) {
+      cerr << "cannot read " << filename << endl;
+      return 1;
+    }
+    vector<CompareRow> rows;
+    rows.push_back(compare<AVLCollection<string,double>>("AVLCollection", trace, options, false));
+    rows.push_back(compare<CompactAVLCollection<string,double>>("CompactAVLCollection", trace,
+                                                                 options, false));
+    rows.push_back(compare<BTreeCollection<string,double>>("BTreeCollection", trace, options,
+                                                            false));
+    rows.push_back(compare<MapCollection<string,double>>("std::map", trace, options, false));
+    rows.push_back(compare<HashCollection<string,double>>("std::unordered_map", trace, options,
+                                                           true));
+    if (csv)
+      print_csv(filename, rows);
+    else
+      print_table(filename, trace, rows);
+  }
+  return 0;
+}
@@ -0,0 +1,345 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   concurrent_avl_collection.h
+// Description:
+//            Thread-safe wrappers around the AVL tree collection.
+//
+//            SharedAVLCollection guards one tree with a reader-writer
+//            lock: any number of finds, range searches and traversals
+//            run in parallel, adds and removes run alone.
+//
+//            SnapshotAVLCollection never makes readers wait for
+//            writers. Readers work on an immutable published version
+//            of the tree; a writer derives the next version with a
+//            path-copying update (see persistent_avl_collection.h),
+//            which costs O(log n) new nodes, and publishes it. Writers
+//            are serialized with each other.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef CONCURRENT_AVL_COLLECTION_H
+#define CONCURRENT_AVL_COLLECTION_H
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include "collection.h"
+#include "avl_collection.h"
+#include "persistent_avl_collection.h"
+
+
+template<typename K, typename V>
+class SharedAVLCollection : public Collection<K,V>
+{
+public:
+
+  // create an empty collection
+  SharedAVLCollection();
+
+  // create a collection holding a copy of initial
+  SharedAVLCollection(const AVLCollection<K,V>& initial);
+
+  // add a new key-value pair into the collection
+  void add(const K& a_key, const V& a_val);
+
+  // remove a key-value pair from the collection
+  bool remove(const K& a_key);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // call visit(key, value) for each pair with k1 <= key <= k2
+  template<typename Visitor>
+  void visit_range(const K& k1, const K& k2, Visitor visit) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+  // return the height of the tree
+  int height() const;
+
+  // run reader(tree) while holding the lock in shared mode, so several
+  // reads see the same state
+  template<typename Reader>
+  void read(Reader reader) const;
+
+private:
+
+  // guards tree: shared for readers, exclusive for writers
+  mutable std::shared_mutex lock;
+
+  AVLCollection<K,V> tree;
+};
+
+
+template<typename K, typename V>
+class SnapshotAVLCollection : public Collection<K,V>
+{
+public:
+
+  // a published, read-only version of the tree
+  typedef std::shared_ptr<const PersistentAVLCollection<K,V>> Snapshot;
+
+  // create an empty collection
+  SnapshotAVLCollection();
+
+  // create a collection whose first version is a copy of initial
+  SnapshotAVLCollection(const AVLCollection<K,V>& initial);
+
+  // add a new key-value pair into the collection
+  void add(const K& a_key, const V& a_val);
+
+  // remove a key-value pair from the collection
+  bool remove(const K& a_key);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+  // return the height of the tree
+  int height() const;
+
+  // return the current version; it stays valid and unchanged for as
+  // long as the caller holds on to it
+  Snapshot snapshot() const;
+
+private:
+
+  // serializes writers (readers never take it)
+  std::mutex write_lock;
+
+  // current version, read and replaced atomically
+  std::atomic<Snapshot> current;
+};
+
+
+//------------------------------------------------------------------------------
+// SharedAVLCollection
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V>
+SharedAVLCollection<K,V>::SharedAVLCollection()
+{
+}
+
+
+// the copy gets its own allocator, so other threads can keep using
+// a collection split off from initial
+template<typename K, typename V>
+SharedAVLCollection<K,V>::SharedAVLCollection(const AVLCollection<K,V>& initial)
+  : tree(initial)
+{
+  assert(!tree.shares_allocator());
+}
+
+
+template<typename K, typename V>
+void SharedAVLCollection<K,V>::add(const K& a_key, const V& a_val)
+{
+  std::unique_lock<std::shared_mutex> guard(lock);
+  tree.add(a_key, a_val);
+}
+
+
+template<typename K, typename V>
+bool SharedAVLCollection<K,V>::remove(const K& a_key)
+{
+  std::unique_lock<std::shared_mutex> guard(lock);
+  return tree.remove(a_key);
+}
+
+
+template<typename K, typename V>
+bool SharedAVLCollection<K,V>::find(const K& search_key, V& the_val) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock);
+  return tree.find(search_key, the_val);
+}
+
+
+template<typename K, typename V>
+void SharedAVLCollection<K,V>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock);
+  tree.find(k1, k2, vals);
+}
+
+
+template<typename K, typename V>
+template<typename Visitor>
+void SharedAVLCollection<K,V>::visit_range(const K& k1, const K& k2, Visitor visit) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock);
+  tree.visit_range(k1, k2, visit);
+}
+
+
+template<typename K, typename V>
+void SharedAVLCollection<K,V>::keys(std::vector<K>& all_keys) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock);
+  tree.keys(all_keys);
+}
+
+
+template<typename K, typename V>
+void SharedAVLCollection<K,V>::sort(std::vector<K>& all_keys_sorted) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock);
+  tree.sort(all_keys_sorted);
+}
+
+
+template<typename K, typename V>
+int SharedAVLCollection<K,V>::size() const
+{
+  std::shared_lock<std::shared_mutex> guard(lock);
+  return tree.size();
+}
+
+
+template<typename K, typename V>
+int SharedAVLCollection<K,V>::height() const
+{
+  std::shared_lock<std::shared_mutex> guard(lock);
+  return tree.height();
+}
+
+
+template<typename K, typename V>
+template<typename Reader>
+void SharedAVLCollection<K,V>::read(Reader reader) const
+{
+  std::shared_lock<std::shared_mutex> guard(lock);
+  reader(static_cast<const AVLCollection<K,V>&>(tree));
+}
+
+
+//------------------------------------------------------------------------------
+// SnapshotAVLCollection
+//------------------------------------------------------------------------------
+
+
+// starts out with an empty published version
+template<typename K, typename V>
+SnapshotAVLCollection<K,V>::SnapshotAVLCollection()
+  : current(std::make_shared<const PersistentAVLCollection<K,V>>())
+{
+}
+
+
+// publishes the contents of initial as the first version
+template<typename K, typename V>
+SnapshotAVLCollection<K,V>::SnapshotAVLCollection(const AVLCollection<K,V>& initial)
+{
+  std::vector<std::pair<K,V>> kvs;
+  kvs.reserve(initial.size());
+  for(const typename AVLCollection<K,V>::Entry& entry : initial)
+    kvs.push_back(std::make_pair(entry.key, entry.value));
+  current.store(std::make_shared<const PersistentAVLCollection<K,V>>(kvs.begin(), kvs.end()));
+}
+
+
+// derives the next version from the current one and publishes it
+template<typename K, typename V>
+void SnapshotAVLCollection<K,V>::add(const K& a_key, const V& a_val)
+{
+  std::lock_guard<std::mutex> guard(write_lock);
+  std::shared_ptr<PersistentAVLCollection<K,V>> next =
+    std::make_shared<PersistentAVLCollection<K,V>>(*current.load());
+  next -> add(a_key, a_val);
+  current.store(Snapshot(std::move(next)));
+}
+
+
+// publishes a new version only if the key was there to be removed
+template<typename K, typename V>
+bool SnapshotAVLCollection<K,V>::remove(const K& a_key)
+{
+  std::lock_guard<std::mutex> guard(write_lock);
+  std::shared_ptr<PersistentAVLCollection<K,V>> next =
+    std::make_shared<PersistentAVLCollection<K,V>>(*current.load());
+  if(!next -> remove(a_key))
+    return false;
+  current.store(Snapshot(std::move(next)));
+  return true;
+}
+
+
+template<typename K, typename V>
+bool SnapshotAVLCollection<K,V>::find(const K& search_key, V& the_val) const
+{
+  return snapshot() -> find(search_key, the_val);
+}
+
+
+template<typename K, typename V>
+void SnapshotAVLCollection<K,V>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  snapshot() -> find(k1, k2, vals);
+}
+
+
+template<typename K, typename V>
+void SnapshotAVLCollection<K,V>::keys(std::vector<K>& all_keys) const
+{
+  snapshot() -> keys(all_keys);
+}
+
+
+template<typename K, typename V>
+void SnapshotAVLCollection<K,V>::sort(std::vector<K>& all_keys_sorted) const
+{
+  snapshot() -> sort(all_keys_sorted);
+}
+
+
+template<typename K, typename V>
+int SnapshotAVLCollection<K,V>::size() const
+{
+  return snapshot() -> size();
+}
+
+
+template<typename K, typename V>
+int SnapshotAVLCollection<K,V>::height() const
+{
+  return snapshot() -> height();
+}
+
+
+// returns the most recently published version
+template<typename K, typename V>
+typename SnapshotAVLCollection<K,V>::Snapshot
+SnapshotAVLCollection<K,V>::snapshot() const
+{
+  return current.load();
+}
+
+
+#endif
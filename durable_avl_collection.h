@@ -0,0 +1,580 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   durable_avl_collection.h
+// Description:
+//            A crash-safe AVL tree key-value pair collection. Every
+//            add and remove is applied to an in-memory AVLCollection
+//            and appended to a write-ahead log (<base>.log). Log
+//            records are group committed: they are buffered and
+//            written and synced together once batch_size records are
+//            waiting or sync_interval has passed since the oldest one
+//            (checked on each update; call sync() to commit at once).
+//            A batch that can't be written or synced is cut back out
+//            of the log and kept, to be retried by the next commit;
+//            io_error reports the failure.
+//            Every checkpoint_records records the tree is saved as an
+//            image (<base>.ckpt, see mapped_avl_collection.h) and the
+//            log is emptied; a checkpoint that fails is tried again
+//            checkpoint_records records later.
+//
+//            Opening a collection loads the checkpoint and replays the
+//            log, stopping at the first torn or corrupt record. Replay
+//            treats an add as "set the key's value" and a remove as
+//            "drop the key if present", so replaying records that are
+//            already in the checkpoint (after a crash between saving
+//            the checkpoint and emptying the log) is harmless. Like
+//            every collection, keys are expected to be unique.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef DURABLE_AVL_COLLECTION_H
+#define DURABLE_AVL_COLLECTION_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "collection.h"
+#include "avl_collection.h"
+#include "mapped_avl_collection.h"
+
+
+// durability and throughput knobs
+struct DurableOptions {
+  // records committed together (1 syncs every update)
+  int batch_size = 64;
+
+  // longest time a record waits to be committed
+  std::chrono::microseconds sync_interval = std::chrono::milliseconds(10);
+
+  // records between checkpoints (0 never checkpoints on its own)
+  long checkpoint_records = 1000000;
+};
+
+
+// how a key or value is written in a log record; fixed-size types are
+// written as-is
+template<typename T>
+struct LogCodec
+{
+  static_assert(std::is_trivially_copyable_v<T>,
+                "logs hold trivially copyable types or strings");
+
+  // append the bytes of item to a record
+  static void append(std::string& record, const T& item);
+
+  // read an item, advancing pos; false if the record is too short
+  static bool read(const char*& pos, const char* end, T& item);
+};
+
+
+// strings are written as a 32-bit length and their characters
+template<>
+struct LogCodec<std::string>
+{
+  static void append(std::string& record, const std::string& item);
+  static bool read(const char*& pos, const char* end, std::string& item);
+};
+
+
+template<typename K, typename V>
+class DurableAVLCollection : public Collection<K,V>
+{
+public:
+
+  // open (or create) the collection stored at base, recovering its
+  // contents; check is_open
+  DurableAVLCollection(const std::string& base, const DurableOptions& options = DurableOptions());
+
+  // the log is owned by one collection
+  DurableAVLCollection(const DurableAVLCollection<K,V>& rhs) = delete;
+  DurableAVLCollection<K,V>& operator=(const DurableAVLCollection<K,V>& rhs) = delete;
+
+  // commit any waiting records and close the log
+  ~DurableAVLCollection();
+
+  // true if the log could be opened and recovered
+  bool is_open() const;
+
+  // add a new key-value pair into the collection
+  void add(const K& a_key, const V& a_val);
+
+  // remove a key-value pair from the collection
+  bool remove(const K& a_key);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+  // return the height of the tree
+  int height() const;
+
+  // write and sync all waiting records, returns false on an i/o error
+  // (the records stay waiting)
+  bool sync();
+
+  // save the tree and empty the log, returns false on an i/o error
+  bool checkpoint();
+
+  // number of records logged, and of syncs, since opening
+  long log_records() const;
+  long log_syncs() const;
+
+  // number of records replayed from the log when opening
+  long recovered_records() const;
+
+  // errno of the last failed commit or checkpoint, 0 once a later
+  // commit succeeds (add and remove can't return it)
+  int io_error() const;
+
+private:
+
+  // log record kinds
+  static const std::uint8_t add_op = 1;
+  static const std::uint8_t remove_op = 2;
+
+  // record header: payload length and checksum of the payload
+  static const std::size_t header_size = 8;
+
+  // 32-bit FNV-1a hash used as the record checksum
+  static std::uint32_t checksum(const char* data, std::size_t n);
+
+  // load the checkpoint and replay the log
+  bool recover();
+
+  // buffer one record and commit if the batch is due
+  void log(std::uint8_t op, const K& a_key, const V* a_val);
+
+  // write a whole buffer to the log file
+  bool write_all(const std::string& data);
+
+  // the tree itself
+  AVLCollection<K,V> tree;
+
+  // file names
+  std::string log_file;
+  std::string checkpoint_file;
+
+  DurableOptions options;
+
+  // log file descriptor (-1 if not open)
+  int fd;
+
+  // log size after the last committed batch
+  off_t committed;
+
+  // errno of the last failed commit (0 if none)
+  int error;
+
+  // records waiting to be committed
+  std::string pending;
+  int pending_records;
+  std::chrono::steady_clock::time_point oldest_pending;
+
+  // records since the last checkpoint
+  long since_checkpoint;
+
+  // counters
+  long records;
+  long syncs;
+  long recovered;
+};
+
+
+//------------------------------------------------------------------------------
+// Log Codecs
+//------------------------------------------------------------------------------
+
+
+template<typename T>
+void LogCodec<T>::append(std::string& record, const T& item)
+{
+  record.append(reinterpret_cast<const char*>(&item), sizeof(T));
+}
+
+
+template<typename T>
+bool LogCodec<T>::read(const char*& pos, const char* end, T& item)
+{
+  if(std::size_t(end - pos) < sizeof(T))
+    return false;
+  std::memcpy(&item, pos, sizeof(T));
+  pos += sizeof(T);
+  return true;
+}
+
+
+inline void LogCodec<std::string>::append(std::string& record, const std::string& item)
+{
+  std::uint32_t n = item.size();
+  record.append(reinterpret_cast<const char*>(&n), sizeof(n));
+  record.append(item);
+}
+
+
+inline bool LogCodec<std::string>::read(const char*& pos, const char* end, std::string& item)
+{
+  std::uint32_t n;
+  if(std::size_t(end - pos) < sizeof(n))
+    return false;
+  std::memcpy(&n, pos, sizeof(n));
+  pos += sizeof(n);
+  if(std::size_t(end - pos) < n)
+    return false;
+  item.assign(pos, n);
+  pos += n;
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+// DurableAVLCollection
+//------------------------------------------------------------------------------
+
+
+// recovers the contents, then opens the log for appending
+template<typename K, typename V>
+DurableAVLCollection<K,V>::DurableAVLCollection(const std::string& base,
+                                                const DurableOptions& options)
+  : log_file(base + ".log"), checkpoint_file(base + ".ckpt"), options(options), fd(-1),
+    committed(0), error(0), pending_records(0), since_checkpoint(0), records(0), syncs(0), recovered(0)
+{
+  if(!recover())
+    return;
+  fd = ::open(log_file.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if(fd >= 0 && (committed = ::lseek(fd, 0, SEEK_END)) < 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+
+template<typename K, typename V>
+DurableAVLCollection<K,V>::~DurableAVLCollection()
+{
+  if(fd < 0)
+    return;
+  sync();
+  ::close(fd);
+}
+
+
+template<typename K, typename V>
+bool DurableAVLCollection<K,V>::is_open() const
+{
+  return fd >= 0;
+}
+
+
+// applies the add, then logs it
+template<typename K, typename V>
+void DurableAVLCollection<K,V>::add(const K& a_key, const V& a_val)
+{
+  tree.add(a_key, a_val);
+  log(add_op, a_key, &a_val);
+}
+
+
+// only logs removes that change the tree
+template<typename K, typename V>
+bool DurableAVLCollection<K,V>::remove(const K& a_key)
+{
+  if(!tree.remove(a_key))
+    return false;
+  log(remove_op, a_key, nullptr);
+  return true;
+}
+
+
+template<typename K, typename V>
+bool DurableAVLCollection<K,V>::find(const K& search_key, V& the_val) const
+{
+  return tree.find(search_key, the_val);
+}
+
+
+template<typename K, typename V>
+void DurableAVLCollection<K,V>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  tree.find(k1, k2, vals);
+}
+
+
+template<typename K, typename V>
+void DurableAVLCollection<K,V>::keys(std::vector<K>& all_keys) const
+{
+  tree.keys(all_keys);
+}
+
+
+template<typename K, typename V>
+void DurableAVLCollection<K,V>::sort(std::vector<K>& all_keys_sorted) const
+{
+  tree.sort(all_keys_sorted);
+}
+
+
+template<typename K, typename V>
+int DurableAVLCollection<K,V>::size() const
+{
+  return tree.size();
+}
+
+
+template<typename K, typename V>
+int DurableAVLCollection<K,V>::height() const
+{
+  return tree.height();
+}
+
+
+// one write and one sync for the whole batch; on failure the part of
+// the batch that reached the log is truncated away, so the retry (and
+// every later batch) follows the last good record instead of a torn
+// one. If even that fails the log is closed rather than appended to.
+template<typename K, typename V>
+bool DurableAVLCollection<K,V>::sync()
+{
+  if(fd < 0)
+    return false;
+  if(pending_records == 0)
+    return true;
+  if(!write_all(pending) || ::fdatasync(fd) != 0)
+  {
+    error = errno;
+    if(::ftruncate(fd, committed) != 0)
+    {
+      ::close(fd);
+      fd = -1;
+    }
+    return false;
+  }
+  committed += pending.size();
+  pending.clear();
+  pending_records = 0;
+  syncs++;
+  error = 0;
+  return true;
+}
+
+
+// the new checkpoint replaces the old one atomically (by rename)
+// before the log is emptied; a crash in between leaves the new
+// checkpoint plus a log whose replay changes nothing
+template<typename K, typename V>
+bool DurableAVLCollection<K,V>::checkpoint()
+{
+  if(!sync())
+    return false;
+  std::string temp_file = checkpoint_file + ".tmp";
+  if(!save_image(tree, temp_file))
+    return false;
+  int temp_fd = ::open(temp_file.c_str(), O_RDONLY);
+  if(temp_fd < 0)
+    return false;
+  bool ok = ::fsync(temp_fd) == 0;
+  ::close(temp_fd);
+  if(!ok || std::rename(temp_file.c_str(), checkpoint_file.c_str()) != 0)
+    return false;
+
+  // make the rename itself durable
+  std::string::size_type slash = checkpoint_file.rfind('/');
+  std::string dir = slash == std::string::npos ? "." : checkpoint_file.substr(0, slash + 1);
+  int dir_fd = ::open(dir.c_str(), O_RDONLY);
+  if(dir_fd < 0)
+    return false;
+  ok = ::fsync(dir_fd) == 0;
+  ::close(dir_fd);
+  if(!ok)
+    return false;
+  if(::ftruncate(fd, 0) != 0)
+    return false;
+  committed = 0;
+  if(::fdatasync(fd) != 0)
+    return false;
+  since_checkpoint = 0;
+  return true;
+}
+
+
+template<typename K, typename V>
+long DurableAVLCollection<K,V>::log_records() const
+{
+  return records;
+}
+
+
+template<typename K, typename V>
+long DurableAVLCollection<K,V>::log_syncs() const
+{
+  return syncs;
+}
+
+
+template<typename K, typename V>
+long DurableAVLCollection<K,V>::recovered_records() const
+{
+  return recovered;
+}
+
+
+template<typename K, typename V>
+int DurableAVLCollection<K,V>::io_error() const
+{
+  return error;
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V>
+std::uint32_t DurableAVLCollection<K,V>::checksum(const char* data, std::size_t n)
+{
+  std::uint32_t hash = 2166136261u;
+  for(std::size_t i = 0; i < n; ++i)
+  {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+
+// a missing checkpoint or log just means an empty start; a log that
+// ends in a partial or corrupt record is cut back to the last good one
+template<typename K, typename V>
+bool DurableAVLCollection<K,V>::recover()
+{
+  if(::access(checkpoint_file.c_str(), F_OK) == 0 && !load_image(tree, checkpoint_file))
+    return false;
+
+  int log_fd = ::open(log_file.c_str(), O_RDONLY);
+  if(log_fd < 0)
+    return true;
+  std::string data;
+  char buffer[1 << 16];
+  ssize_t n;
+  while((n = ::read(log_fd, buffer, sizeof(buffer))) > 0)
+    data.append(buffer, n);
+  ::close(log_fd);
+  if(n < 0)
+    return false;
+
+  const char* pos = data.data();
+  const char* end = data.data() + data.size();
+  while(std::size_t(end - pos) >= header_size)
+  {
+    std::uint32_t length, sum;
+    std::memcpy(&length, pos, sizeof(length));
+    std::memcpy(&sum, pos + sizeof(length), sizeof(sum));
+    const char* payload = pos + header_size;
+    if(std::size_t(end - payload) < length || length == 0 || checksum(payload, length) != sum)
+      break;
+    const char* field = payload + 1;
+    const char* payload_end = payload + length;
+    K key;
+    V val;
+    if(!LogCodec<K>::read(field, payload_end, key))
+      break;
+    if(payload[0] == add_op && LogCodec<V>::read(field, payload_end, val))
+    {
+      tree.remove(key);
+      tree.add(key, val);
+    } else if(payload[0] == remove_op)
+      tree.remove(key);
+    else
+      break;
+    pos = payload_end;
+    recovered++;
+  }
+  since_checkpoint = recovered;
+  if(pos != end)
+    return ::truncate(log_file.c_str(), pos - data.data()) == 0;
+  return true;
+}
+
+
+// record: payload length, checksum, then the payload (op, key and
+// value)
+template<typename K, typename V>
+void DurableAVLCollection<K,V>::log(std::uint8_t op, const K& a_key, const V* a_val)
+{
+  if(fd < 0)
+    return;
+  std::size_t start = pending.size();
+  pending.append(header_size, '\0');
+  pending.push_back(char(op));
+  LogCodec<K>::append(pending, a_key);
+  if(a_val != nullptr)
+    LogCodec<V>::append(pending, *a_val);
+  std::uint32_t length = pending.size() - start - header_size;
+  std::uint32_t sum = checksum(pending.data() + start + header_size, length);
+  std::memcpy(pending.data() + start, &length, sizeof(length));
+  std::memcpy(pending.data() + start + sizeof(length), &sum, sizeof(sum));
+
+  auto now = std::chrono::steady_clock::now();
+  if(pending_records == 0)
+    oldest_pending = now;
+  pending_records++;
+  records++;
+  since_checkpoint++;
+  if(pending_records >= options.batch_size || now - oldest_pending >= options.sync_interval)
+    sync();
+  // a failed checkpoint is retried only after another full interval,
+  // so an i/o error doesn't turn every update into a tree save and sync
+  if(options.checkpoint_records > 0 && since_checkpoint >= options.checkpoint_records)
+  {
+    errno = 0;
+    if(!checkpoint())
+    {
+      error = errno != 0 ? errno : EIO;
+      since_checkpoint = 0;
+    }
+  }
+}
+
+
+template<typename K, typename V>
+bool DurableAVLCollection<K,V>::write_all(const std::string& data)
+{
+  const char* pos = data.data();
+  std::size_t left = data.size();
+  while(left > 0)
+  {
+    ssize_t n = ::write(fd, pos, left);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0)
+      return false;
+    pos += n;
+    left -= n;
+  }
+  return true;
+}
+
+
+#endif
@@ -0,0 +1,150 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   fixed_key.h
+// Description:
+//            Fixed-width string key for the AVL tree collection. A
+//            FixedKey<N> holds up to N characters inline (no heap
+//            storage), packed big-endian into 64-bit words so that
+//            comparing two keys is a comparison of one or two
+//            integers instead of a std::string::compare. Shorter
+//            strings are padded with zero bytes; longer strings are
+//            cut to N characters.
+//
+//            FixedKeyAVLCollection<N,V> is the AVL collection
+//            specialized for such keys: each node carries its key
+//            inline, so a lookup touches one node per level.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef FIXED_KEY_H
+#define FIXED_KEY_H
+
+#include <array>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include "avl_collection.h"
+
+
+template<std::size_t N>
+class FixedKey
+{
+public:
+
+  // create the empty key
+  FixedKey();
+
+  // create a key from (the first N characters of) a string
+  FixedKey(std::string_view str);
+  FixedKey(const std::string& str);
+  FixedKey(const char* str);
+
+  // return the key as a string (without the padding)
+  std::string str() const;
+
+  // keys compare as their packed words, which orders them the same
+  // way as the strings they hold
+  friend std::strong_ordering operator<=>(const FixedKey<N>& lhs, const FixedKey<N>& rhs)
+  {
+    for(std::size_t i = 0; i < word_count; ++i)
+      if(lhs.words[i] != rhs.words[i])
+        return lhs.words[i] <=> rhs.words[i];
+    return std::strong_ordering::equal;
+  }
+
+  friend bool operator==(const FixedKey<N>& lhs, const FixedKey<N>& rhs)
+  {
+    return lhs.words == rhs.words;
+  }
+
+private:
+
+  // number of 64-bit words needed for N bytes
+  static const std::size_t word_count = (N + 7) / 8;
+
+  // key bytes, eight per word, first byte in the high bits
+  std::array<std::uint64_t, word_count> words;
+};
+
+
+// collection of fixed-width keys
+template<std::size_t N, typename V>
+using FixedKeyAVLCollection = AVLCollection<FixedKey<N>, V>;
+
+
+// creates the empty key (all padding)
+template<std::size_t N>
+FixedKey<N>::FixedKey()
+{
+  words.fill(0);
+}
+
+
+// packs the characters of str big-endian into the words
+template<std::size_t N>
+FixedKey<N>::FixedKey(std::string_view str)
+{
+  words.fill(0);
+  std::size_t n = str.size() < N ? str.size() : N;
+  for(std::size_t i = 0; i < n; ++i)
+  {
+    std::uint64_t byte = static_cast<unsigned char>(str[i]);
+    words[i / 8] |= byte << (56 - 8 * (i % 8));
+  }
+}
+
+
+template<std::size_t N>
+FixedKey<N>::FixedKey(const std::string& str)
+  : FixedKey(std::string_view(str))
+{
+}
+
+
+template<std::size_t N>
+FixedKey<N>::FixedKey(const char* str)
+  : FixedKey(std::string_view(str))
+{
+}
+
+
+// unpacks the words, stopping at the first padding byte
+template<std::size_t N>
+std::string FixedKey<N>::str() const
+{
+  std::string result;
+  for(std::size_t i = 0; i < N; ++i)
+  {
+    char c = static_cast<char>(words[i / 8] >> (56 - 8 * (i % 8)));
+    if(c == '\0')
+      break;
+    result.push_back(c);
+  }
+  return result;
+}
+
+
+// reads a whitespace-delimited word into a key
+template<std::size_t N>
+std::istream& operator>>(std::istream& in, FixedKey<N>& key)
+{
+  std::string str;
+  if(in >> str)
+    key = FixedKey<N>(str);
+  return in;
+}
+
+
+// writes the characters of a key
+template<std::size_t N>
+std::ostream& operator<<(std::ostream& out, const FixedKey<N>& key)
+{
+  return out << key.str();
+}
+
+
+#endif
@@ -0,0 +1,249 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   frozen_avl_collection.h
+// Description:
+//            A read-only, cache-friendly image of an AVL tree
+//            collection, made by AVLCollection::freeze(). The keys
+//            are stored in one contiguous array in Eytzinger (BFS)
+//            order: the children of slot i are slots 2i and 2i+1, so
+//            the top levels of the tree share a few cache lines and
+//            the next levels can be prefetched without chasing
+//            pointers. Values are kept in a parallel array that only
+//            the final match touches. Searches descend without a
+//            branch on the comparison, and range searches walk
+//            successors in place.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef FROZEN_AVL_COLLECTION_H
+#define FROZEN_AVL_COLLECTION_H
+
+#include <vector>
+#include <bit>
+#include <cstddef>
+#include <iterator>
+#include "avl_collection.h"
+
+
+template<typename K, typename V, typename Compare>
+class FrozenAVLCollection
+{
+public:
+
+  // create an empty collection
+  FrozenAVLCollection();
+
+  // build from a range of entries (with key and value members) sorted
+  // by key
+  template<typename Iter>
+  FrozenAVLCollection(Iter first, Iter last);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // call visit(key, value) for each pair with k1 <= key <= k2, in
+  // key order
+  template<typename Visitor>
+  void visit_range(const K& k1, const K& k2, Visitor visit) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+  // return the height of the (complete) tree
+  int height() const;
+
+private:
+
+  // number of slots that share a cache line with slot i's row; the
+  // descent prefetches that many levels ahead
+  static const std::size_t prefetch_stride =
+    sizeof(K) >= 64 ? 1 : 64 / sizeof(K);
+
+  // fill the subtree at slot i from the next entries of a sorted range
+  template<typename Iter>
+  void build(std::size_t i, Iter& next);
+
+  // slot of the first key >= search_key, or 0 if there is none
+  std::size_t lower_slot(const K& search_key) const;
+
+  // slot of the next larger key, or 0 after the largest
+  std::size_t next_slot(std::size_t i) const;
+
+  // slot of the smallest key, or 0 if empty
+  std::size_t first_slot() const;
+
+  // keys and values in Eytzinger order, slot 0 unused
+  std::vector<K> key_slots;
+  std::vector<V> value_slots;
+
+  // number of k-v pairs in the collection
+  std::size_t count;
+
+  // three-way key comparison
+  Compare compare;
+};
+
+
+// copies the pairs, in key order, into a frozen layout
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+FrozenAVLCollection<K,V,Compare> AVLCollection<K,V,Compare,Alloc,Stats>::freeze() const
+{
+  return FrozenAVLCollection<K,V,Compare>(begin(), end());
+}
+
+
+// constructs an empty collection
+template<typename K, typename V, typename Compare>
+FrozenAVLCollection<K,V,Compare>::FrozenAVLCollection()
+  : key_slots(1), value_slots(1), count(0)
+{
+}
+
+
+// lays the sorted entries out by an in-order walk of the slot tree
+template<typename K, typename V, typename Compare>
+template<typename Iter>
+FrozenAVLCollection<K,V,Compare>::FrozenAVLCollection(Iter first, Iter last)
+{
+  count = std::distance(first, last);
+  key_slots.resize(count + 1);
+  value_slots.resize(count + 1);
+  build(1, first);
+}
+
+
+template<typename K, typename V, typename Compare>
+bool FrozenAVLCollection<K,V,Compare>::find(const K& search_key, V& the_val) const
+{
+  std::size_t i = lower_slot(search_key);
+  if(i == 0 || compare(search_key, key_slots[i]) != 0)
+    return false;
+  the_val = value_slots[i];
+  return true;
+}
+
+
+template<typename K, typename V, typename Compare>
+void FrozenAVLCollection<K,V,Compare>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  visit_range(k1, k2, [&vals](const K& key, const V& val) { vals.push_back(val); });
+}
+
+
+// starts at the first key >= k1 and steps through successors
+template<typename K, typename V, typename Compare>
+template<typename Visitor>
+void FrozenAVLCollection<K,V,Compare>::visit_range(const K& k1, const K& k2, Visitor visit) const
+{
+  for(std::size_t i = lower_slot(k1); i != 0 && compare(k2, key_slots[i]) >= 0; i = next_slot(i))
+    visit(key_slots[i], value_slots[i]);
+}
+
+
+template<typename K, typename V, typename Compare>
+void FrozenAVLCollection<K,V,Compare>::keys(std::vector<K>& all_keys) const
+{
+  for(std::size_t i = first_slot(); i != 0; i = next_slot(i))
+    all_keys.push_back(key_slots[i]);
+}
+
+
+template<typename K, typename V, typename Compare>
+void FrozenAVLCollection<K,V,Compare>::sort(std::vector<K>& all_keys_sorted) const
+{
+  keys(all_keys_sorted);
+}
+
+
+template<typename K, typename V, typename Compare>
+int FrozenAVLCollection<K,V,Compare>::size() const
+{
+  return count;
+}
+
+
+// every level but the last is full
+template<typename K, typename V, typename Compare>
+int FrozenAVLCollection<K,V,Compare>::height() const
+{
+  return std::bit_width(count);
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V, typename Compare>
+template<typename Iter>
+void FrozenAVLCollection<K,V,Compare>::build(std::size_t i, Iter& next)
+{
+  if(i > count)
+    return;
+  build(2 * i, next);
+  key_slots[i] = next -> key;
+  value_slots[i] = next -> value;
+  ++next;
+  build(2 * i + 1, next);
+}
+
+
+// descends to a leaf going right whenever the slot's key is smaller
+// (the comparison result is the next slot's low bit, not a branch),
+// then undoes the trailing right turns plus one left turn to get back
+// to the last slot where the search went left
+template<typename K, typename V, typename Compare>
+std::size_t FrozenAVLCollection<K,V,Compare>::lower_slot(const K& search_key) const
+{
+  std::size_t i = 1;
+  while(i <= count)
+  {
+#if defined(__GNUC__)
+    __builtin_prefetch(key_slots.data() + prefetch_stride * i);
+#endif
+    i = 2 * i + (compare(key_slots[i], search_key) < 0);
+  }
+  return i >> (std::countr_one(i) + 1);
+}
+
+
+// leftmost slot of the right subtree if there is one, otherwise the
+// first ancestor reached from its left
+template<typename K, typename V, typename Compare>
+std::size_t FrozenAVLCollection<K,V,Compare>::next_slot(std::size_t i) const
+{
+  if(2 * i + 1 <= count)
+  {
+    i = 2 * i + 1;
+    while(2 * i <= count)
+      i = 2 * i;
+    return i;
+  }
+  return i >> (std::countr_one(i) + 1);
+}
+
+
+template<typename K, typename V, typename Compare>
+std::size_t FrozenAVLCollection<K,V,Compare>::first_slot() const
+{
+  if(count == 0)
+    return 0;
+  std::size_t i = 1;
+  while(2 * i <= count)
+    i = 2 * i;
+  return i;
+}
+
+
+#endif
@@ -0,0 +1,489 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   mapped_avl_collection.h
+// Description:
+//            Binary on-disk image of an AVL tree collection and a
+//            read-only collection that searches the image in place.
+//
+//            save_image() writes a header followed by the
+//            keys and the values, each as one block in key order.
+//            Fixed-size (trivially copyable) keys and values are
+//            stored as plain arrays; strings are stored as an array
+//            of offsets into a block of characters. Every location is
+//            an offset from the start of the file, so the image can
+//            be mapped at any address.
+//
+//            MappedAVLCollection maps an image with mmap (shared,
+//            read-only, so every process opening the same file shares
+//            the page cache) and binary-searches the key block
+//            directly; nothing is parsed or copied until a value is
+//            returned. load_image() rebuilds a normal AVLCollection
+//            from an image in linear time.
+//
+//            The image uses the byte order of the machine that wrote
+//            it; a version or layout mismatch makes the open fail.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef MAPPED_AVL_COLLECTION_H
+#define MAPPED_AVL_COLLECTION_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "avl_collection.h"
+
+
+// where one column (the keys or the values) lives in the image: fixed
+// columns are an array at offset; string columns are count + 1
+// offsets at offset into the characters at data_offset
+struct MappedSection {
+  std::uint64_t offset;
+  std::uint64_t data_offset;
+  std::uint64_t element_size;
+};
+
+
+// start of every image
+struct MappedHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t header_size;
+  std::uint64_t count;
+  std::uint64_t file_size;
+  MappedSection keys;
+  MappedSection values;
+};
+
+
+// image constants
+const char mapped_magic[8] = {'A', 'V', 'L', 'I', 'M', 'A', 'G', 'E'};
+const std::uint32_t mapped_version = 1;
+
+
+// how a type is stored in an image column; fixed-size types are
+// stored as-is and read back through a pointer into the image
+template<typename T>
+struct MappedColumn
+{
+  static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= 8,
+                "mapped images hold trivially copyable types or strings");
+
+  typedef T view_type;
+
+  static const std::uint64_t element_size = sizeof(T);
+
+  // append the items to the image, recording where they went
+  static void append(std::string& image, const std::vector<const T*>& items,
+                     MappedSection& section);
+
+  // the i-th item of the column
+  static const T& at(const char* image, const MappedSection& section, std::size_t i);
+
+  // check that the column of count items fits in the image
+  static bool valid(const char* image, std::uint64_t file_size, const MappedSection& section,
+                    std::uint64_t count);
+};
+
+
+// strings are stored as offsets into a block of characters and read
+// back as views into the image
+template<>
+struct MappedColumn<std::string>
+{
+  typedef std::string_view view_type;
+
+  static const std::uint64_t element_size = 0;
+
+  static void append(std::string& image, const std::vector<const std::string*>& items,
+                     MappedSection& section);
+
+  static std::string_view at(const char* image, const MappedSection& section, std::size_t i);
+
+  static bool valid(const char* image, std::uint64_t file_size, const MappedSection& section,
+                    std::uint64_t count);
+};
+
+
+// write the pairs of coll to a binary image file, returns false if
+// the file couldn't be written
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool save_image(const AVLCollection<K,V,Compare,Alloc,Stats>& coll, const std::string& filename);
+
+// replace the contents of coll with the pairs of an image file,
+// returns false if it isn't a valid image for K and V
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool load_image(AVLCollection<K,V,Compare,Alloc,Stats>& coll, const std::string& filename);
+
+
+template<typename K, typename V, typename Compare = ThreeWayCompare>
+class MappedAVLCollection
+{
+public:
+
+  typedef typename MappedColumn<K>::view_type key_view;
+  typedef typename MappedColumn<V>::view_type value_view;
+
+  // map an image written by save_image; check is_open
+  MappedAVLCollection(const std::string& filename);
+
+  // a mapping is owned by one collection
+  MappedAVLCollection(const MappedAVLCollection<K,V,Compare>& rhs) = delete;
+  MappedAVLCollection<K,V,Compare>& operator=(const MappedAVLCollection<K,V,Compare>& rhs) = delete;
+
+  // unmap the image
+  ~MappedAVLCollection();
+
+  // true if the file was mapped and is a valid image for K and V
+  bool is_open() const;
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // call visit(key, value) with views into the image for each pair
+  // with k1 <= key <= k2, in key order
+  template<typename Visitor>
+  void visit_range(const K& k1, const K& k2, Visitor visit) const;
+
+  // call visit(key, value) with views into the image for every pair,
+  // in key order
+  template<typename Visitor>
+  void visit(Visitor visit) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+private:
+
+  // index of the first key >= search_key
+  std::size_t lower_index(const K& search_key) const;
+
+  // i-th key and value, viewed in place
+  key_view key_at(std::size_t i) const;
+  value_view value_at(std::size_t i) const;
+
+  // start of the mapping (nullptr if not open)
+  const char* image;
+
+  // bytes mapped
+  std::size_t image_size;
+
+  // copy of the image header
+  MappedHeader header;
+
+  // three-way key comparison
+  Compare compare;
+};
+
+
+//------------------------------------------------------------------------------
+// Image Columns
+//------------------------------------------------------------------------------
+
+
+// pads the image to a multiple of 8 bytes so every block is aligned
+inline void mapped_align(std::string& image)
+{
+  image.resize((image.size() + 7) / 8 * 8, '\0');
+}
+
+
+template<typename T>
+void MappedColumn<T>::append(std::string& image, const std::vector<const T*>& items,
+                             MappedSection& section)
+{
+  mapped_align(image);
+  section.offset = image.size();
+  section.data_offset = 0;
+  section.element_size = element_size;
+  for(const T* item : items)
+    image.append(reinterpret_cast<const char*>(item), sizeof(T));
+}
+
+
+template<typename T>
+const T& MappedColumn<T>::at(const char* image, const MappedSection& section, std::size_t i)
+{
+  return reinterpret_cast<const T*>(image + section.offset)[i];
+}
+
+
+template<typename T>
+bool MappedColumn<T>::valid(const char*, std::uint64_t file_size,
+                            const MappedSection& section, std::uint64_t count)
+{
+  return section.element_size == element_size && section.offset % 8 == 0 &&
+    section.offset <= file_size && count <= (file_size - section.offset) / sizeof(T);
+}
+
+
+inline void MappedColumn<std::string>::append(std::string& image,
+                                              const std::vector<const std::string*>& items,
+                                              MappedSection& section)
+{
+  mapped_align(image);
+  section.offset = image.size();
+  section.element_size = element_size;
+  std::uint64_t chars = 0;
+  for(std::size_t i = 0; i <= items.size(); ++i)
+  {
+    image.append(reinterpret_cast<const char*>(&chars), sizeof(chars));
+    if(i < items.size())
+      chars += items[i] -> size();
+  }
+  section.data_offset = image.size();
+  for(const std::string* item : items)
+    image.append(*item);
+}
+
+
+inline std::string_view MappedColumn<std::string>::at(const char* image,
+                                                      const MappedSection& section,
+                                                      std::size_t i)
+{
+  const std::uint64_t* offsets = reinterpret_cast<const std::uint64_t*>(image + section.offset);
+  return std::string_view(image + section.data_offset + offsets[i], offsets[i + 1] - offsets[i]);
+}
+
+
+// checks that the offset array and the last string end inside the
+// image (the offsets in between are trusted, so that opening an image
+// doesn't touch every page of it)
+inline bool MappedColumn<std::string>::valid(const char* image, std::uint64_t file_size,
+                                             const MappedSection& section, std::uint64_t count)
+{
+  if(section.element_size != element_size || section.offset % 8 != 0 ||
+     section.offset > file_size || count >= (file_size - section.offset) / 8 ||
+     section.data_offset > file_size)
+    return false;
+  const std::uint64_t* offsets = reinterpret_cast<const std::uint64_t*>(image + section.offset);
+  return offsets[0] == 0 && offsets[count] <= file_size - section.data_offset;
+}
+
+
+//------------------------------------------------------------------------------
+// Image Save and Load
+//------------------------------------------------------------------------------
+
+
+// builds the whole image in memory and writes it with one call
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool save_image(const AVLCollection<K,V,Compare,Alloc,Stats>& coll, const std::string& filename)
+{
+  std::vector<const K*> key_items;
+  std::vector<const V*> value_items;
+  key_items.reserve(coll.size());
+  value_items.reserve(coll.size());
+  for(const auto& entry : coll)
+  {
+    key_items.push_back(&entry.key);
+    value_items.push_back(&entry.value);
+  }
+
+  MappedHeader header = {};
+  std::memcpy(header.magic, mapped_magic, sizeof(header.magic));
+  header.version = mapped_version;
+  header.header_size = sizeof(MappedHeader);
+  header.count = coll.size();
+  std::string image(sizeof(MappedHeader), '\0');
+  MappedColumn<K>::append(image, key_items, header.keys);
+  MappedColumn<V>::append(image, value_items, header.values);
+  mapped_align(image);
+  header.file_size = image.size();
+  std::memcpy(image.data(), &header, sizeof(header));
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write(image.data(), image.size());
+  return bool(out.flush());
+}
+
+
+// the image is already in key order, so the tree is built directly
+template<typename K, typename V, typename Compare, template<typename> class Alloc, typename Stats>
+bool load_image(AVLCollection<K,V,Compare,Alloc,Stats>& coll, const std::string& filename)
+{
+  MappedAVLCollection<K,V,Compare> mapped(filename);
+  if(!mapped.is_open())
+    return false;
+  std::vector<std::pair<K,V>> kvs;
+  kvs.reserve(mapped.size());
+  mapped.visit([&kvs](const auto& key, const auto& val) { kvs.emplace_back(K(key), V(val)); });
+  coll.bulk_load(kvs.begin(), kvs.end());
+  return true;
+}
+
+
+//------------------------------------------------------------------------------
+// MappedAVLCollection
+//------------------------------------------------------------------------------
+
+
+// maps the file and checks the header and the layout of both columns
+template<typename K, typename V, typename Compare>
+MappedAVLCollection<K,V,Compare>::MappedAVLCollection(const std::string& filename)
+  : image(nullptr), image_size(0), header()
+{
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return;
+  struct stat info;
+  if(::fstat(fd, &info) != 0 || std::size_t(info.st_size) < sizeof(MappedHeader))
+  {
+    ::close(fd);
+    return;
+  }
+  void* addr = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(addr == MAP_FAILED)
+    return;
+  image = static_cast<const char*>(addr);
+  image_size = info.st_size;
+
+  std::memcpy(&header, image, sizeof(header));
+  bool ok = std::memcmp(header.magic, mapped_magic, sizeof(header.magic)) == 0 &&
+    header.version == mapped_version && header.header_size == sizeof(MappedHeader) &&
+    header.file_size == image_size &&
+    MappedColumn<K>::valid(image, image_size, header.keys, header.count) &&
+    MappedColumn<V>::valid(image, image_size, header.values, header.count);
+  if(!ok)
+  {
+    ::munmap(addr, image_size);
+    image = nullptr;
+  }
+}
+
+
+template<typename K, typename V, typename Compare>
+MappedAVLCollection<K,V,Compare>::~MappedAVLCollection()
+{
+  if(image != nullptr)
+    ::munmap(const_cast<char*>(image), image_size);
+}
+
+
+template<typename K, typename V, typename Compare>
+bool MappedAVLCollection<K,V,Compare>::is_open() const
+{
+  return image != nullptr;
+}
+
+
+template<typename K, typename V, typename Compare>
+bool MappedAVLCollection<K,V,Compare>::find(const K& search_key, V& the_val) const
+{
+  std::size_t i = lower_index(search_key);
+  if(i == header.count || compare(key_at(i), search_key) != 0)
+    return false;
+  the_val = V(value_at(i));
+  return true;
+}
+
+
+template<typename K, typename V, typename Compare>
+void MappedAVLCollection<K,V,Compare>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  visit_range(k1, k2, [&vals](key_view key, value_view val) { vals.push_back(V(val)); });
+}
+
+
+template<typename K, typename V, typename Compare>
+template<typename Visitor>
+void MappedAVLCollection<K,V,Compare>::visit_range(const K& k1, const K& k2, Visitor visit) const
+{
+  for(std::size_t i = lower_index(k1); i < header.count && compare(key_at(i), k2) <= 0; ++i)
+    visit(key_at(i), value_at(i));
+}
+
+
+template<typename K, typename V, typename Compare>
+template<typename Visitor>
+void MappedAVLCollection<K,V,Compare>::visit(Visitor visit) const
+{
+  for(std::size_t i = 0; i < header.count; ++i)
+    visit(key_at(i), value_at(i));
+}
+
+
+template<typename K, typename V, typename Compare>
+void MappedAVLCollection<K,V,Compare>::keys(std::vector<K>& all_keys) const
+{
+  for(std::size_t i = 0; i < header.count; ++i)
+    all_keys.push_back(K(key_at(i)));
+}
+
+
+template<typename K, typename V, typename Compare>
+void MappedAVLCollection<K,V,Compare>::sort(std::vector<K>& all_keys_sorted) const
+{
+  keys(all_keys_sorted);
+}
+
+
+template<typename K, typename V, typename Compare>
+int MappedAVLCollection<K,V,Compare>::size() const
+{
+  return header.count;
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+// binary search that halves the range without branching on the
+// comparison (the update compiles to a conditional move)
+template<typename K, typename V, typename Compare>
+std::size_t MappedAVLCollection<K,V,Compare>::lower_index(const K& search_key) const
+{
+  std::size_t len = header.count;
+  if(len == 0)
+    return 0;
+  std::size_t lo = 0;
+  while(len > 1)
+  {
+    std::size_t half = len / 2;
+    lo = compare(key_at(lo + half - 1), search_key) < 0 ? lo + half : lo;
+    len -= half;
+  }
+  return lo + (compare(key_at(lo), search_key) < 0);
+}
+
+
+template<typename K, typename V, typename Compare>
+typename MappedAVLCollection<K,V,Compare>::key_view
+MappedAVLCollection<K,V,Compare>::key_at(std::size_t i) const
+{
+  return MappedColumn<K>::at(image, header.keys, i);
+}
+
+
+template<typename K, typename V, typename Compare>
+typename MappedAVLCollection<K,V,Compare>::value_view
+MappedAVLCollection<K,V,Compare>::value_at(std::size_t i) const
+{
+  return MappedColumn<V>::at(image, header.values, i);
+}
+
+
+#endif
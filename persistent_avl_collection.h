@@ -0,0 +1,422 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   persistent_avl_collection.h
+// Description:
+//            A persistent (immutable-node) AVL tree key-value pair
+//            collection. Nodes are never changed once built: add and
+//            remove copy only the nodes on the path from the root to
+//            the change (O(log n) new nodes) and share everything else
+//            with the previous version. Nodes are reference counted,
+//            so snapshot() is O(1) and old versions stay valid and
+//            readable, from any thread, for as long as someone holds
+//            them.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef PERSISTENT_AVL_COLLECTION_H
+#define PERSISTENT_AVL_COLLECTION_H
+
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <iterator>
+#include "collection.h"
+#include "avl_collection.h"
+
+
+// Compare is a three-way key comparison (see avl_collection.h)
+template<typename K, typename V, typename Compare = ThreeWayCompare>
+class PersistentAVLCollection : public Collection<K,V>
+{
+public:
+
+  // create an empty tree
+  PersistentAVLCollection();
+
+  // build a balanced tree from a range of (key, value) pairs sorted by
+  // key
+  template<typename Iter>
+  PersistentAVLCollection(Iter first, Iter last);
+
+  // add a new key-value pair into the collection
+  void add(const K& a_key, const V& a_val);
+
+  // remove a key-value pair from the collection
+  bool remove(const K& a_key);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // call visit(key, value) for each pair with k1 <= key <= k2
+  template<typename Visitor>
+  void visit_range(const K& k1, const K& k2, Visitor visit) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+  // return the height of the tree
+  int height() const;
+
+  // return the current version (copies are O(1) and share all nodes)
+  PersistentAVLCollection<K,V,Compare> snapshot() const;
+
+private:
+
+  struct Node;
+  typedef std::shared_ptr<const Node> NodePtr;
+
+  // immutable avl tree node
+  struct Node {
+    K key;
+    V value;
+    int height;
+    NodePtr left;
+    NodePtr right;
+  };
+
+  // height of a possibly empty subtree
+  static int node_height(const NodePtr& subtree_root);
+
+  // build a node over two subtrees whose heights differ by at most one
+  static NodePtr make_node(const K& a_key, const V& a_val,
+                           const NodePtr& left, const NodePtr& right);
+
+  // build a node over two subtrees whose heights differ by at most
+  // two, rotating (copying the rotated nodes) if needed
+  static NodePtr balance(const K& a_key, const V& a_val,
+                         const NodePtr& left, const NodePtr& right);
+
+  // recursive add helper, returns the new subtree root
+  NodePtr add(const NodePtr& subtree_root, const K& a_key, const V& a_val) const;
+
+  // recursive remove helper, returns the new subtree root (the same
+  // subtree if the key wasn't found)
+  NodePtr remove(const K& key, const NodePtr& subtree_root, bool& removed) const;
+
+  // helper to drop the leftmost node of a subtree
+  static NodePtr remove_min(const NodePtr& subtree_root, NodePtr& min_node);
+
+  // build a balanced subtree from the next n pairs of a sorted range
+  template<typename Iter>
+  static NodePtr build_sorted(Iter& next, int n);
+
+  // helper to build sorted list of keys (used by keys and sort)
+  static void inorder(const Node* subtree_root, std::vector<K>& keys);
+
+  // helper to recursively visit the pairs in a range of keys
+  template<typename Visitor>
+  void range_search(const Node* subtree_root, const K& k1, const K& k2,
+                    Visitor& visit) const;
+
+  // number of k-v pairs in the collection
+  int tree_size;
+
+  // root node of this version of the tree
+  NodePtr root;
+
+  // three-way key comparison
+  Compare compare;
+};
+
+
+// constructs an empty tree
+template<typename K, typename V, typename Compare>
+PersistentAVLCollection<K,V,Compare>::PersistentAVLCollection()
+  : tree_size(0)
+{
+}
+
+
+// constructs a balanced tree from sorted pairs in O(n)
+template<typename K, typename V, typename Compare>
+template<typename Iter>
+PersistentAVLCollection<K,V,Compare>::PersistentAVLCollection(Iter first, Iter last)
+{
+  tree_size = std::distance(first, last);
+  root = build_sorted(first, tree_size);
+}
+
+
+// replaces the root with a new root that shares all untouched subtrees
+template<typename K, typename V, typename Compare>
+void PersistentAVLCollection<K,V,Compare>::add(const K& a_key, const V& a_val)
+{
+  root = add(root, a_key, a_val);
+  tree_size++;
+}
+
+
+template<typename K, typename V, typename Compare>
+bool PersistentAVLCollection<K,V,Compare>::remove(const K& a_key)
+{
+  bool removed = false;
+  root = remove(a_key, root, removed);
+  if(removed)
+    tree_size--;
+  return removed;
+}
+
+
+template<typename K, typename V, typename Compare>
+bool PersistentAVLCollection<K,V,Compare>::find(const K& search_key, V& the_val) const
+{
+  const Node* cur = root.get();
+  while(cur != nullptr)
+  {
+    auto order = compare(search_key, cur -> key);
+    if(order < 0)
+      cur = cur -> left.get();
+    else if(order > 0)
+      cur = cur -> right.get();
+    else {
+      the_val = cur -> value;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+template<typename K, typename V, typename Compare>
+void PersistentAVLCollection<K,V,Compare>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  auto collect = [&vals](const K& key, const V& val) { vals.push_back(val); };
+  range_search(root.get(), k1, k2, collect);
+}
+
+
+template<typename K, typename V, typename Compare>
+template<typename Visitor>
+void PersistentAVLCollection<K,V,Compare>::visit_range(const K& k1, const K& k2, Visitor visit) const
+{
+  range_search(root.get(), k1, k2, visit);
+}
+
+
+template<typename K, typename V, typename Compare>
+void PersistentAVLCollection<K,V,Compare>::keys(std::vector<K>& all_keys) const
+{
+  inorder(root.get(), all_keys);
+}
+
+
+template<typename K, typename V, typename Compare>
+void PersistentAVLCollection<K,V,Compare>::sort(std::vector<K>& all_keys_sorted) const
+{
+  keys(all_keys_sorted);
+}
+
+
+template<typename K, typename V, typename Compare>
+int PersistentAVLCollection<K,V,Compare>::size() const
+{
+  return tree_size;
+}
+
+
+template<typename K, typename V, typename Compare>
+int PersistentAVLCollection<K,V,Compare>::height() const
+{
+  return node_height(root);
+}
+
+
+// a snapshot is just another handle on the same root
+template<typename K, typename V, typename Compare>
+PersistentAVLCollection<K,V,Compare> PersistentAVLCollection<K,V,Compare>::snapshot() const
+{
+  return *this;
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V, typename Compare>
+int PersistentAVLCollection<K,V,Compare>::node_height(const NodePtr& subtree_root)
+{
+  if(!subtree_root)
+    return 0;
+  return subtree_root -> height;
+}
+
+
+template<typename K, typename V, typename Compare>
+typename PersistentAVLCollection<K,V,Compare>::NodePtr
+PersistentAVLCollection<K,V,Compare>::make_node(const K& a_key, const V& a_val,
+                                        const NodePtr& left, const NodePtr& right)
+{
+  int height = 1 + std::max(node_height(left), node_height(right));
+  return std::make_shared<const Node>(Node{a_key, a_val, height, left, right});
+}
+
+
+// same cases as AVLCollection::rebalance, but the rotated nodes are
+// rebuilt instead of relinked
+template<typename K, typename V, typename Compare>
+typename PersistentAVLCollection<K,V,Compare>::NodePtr
+PersistentAVLCollection<K,V,Compare>::balance(const K& a_key, const V& a_val,
+                                      const NodePtr& left, const NodePtr& right)
+{
+  int heightL = node_height(left);
+  int heightR = node_height(right);
+
+  // if left heavy (balance is greater than 1)
+  if(heightL - heightR > 1)
+  {
+    // if left-right heavy, double rotate
+    if(node_height(left -> left) < node_height(left -> right))
+    {
+      const NodePtr& lr = left -> right;
+      return make_node(lr -> key, lr -> value,
+                       make_node(left -> key, left -> value, left -> left, lr -> left),
+                       make_node(a_key, a_val, lr -> right, right));
+    }
+    return make_node(left -> key, left -> value, left -> left,
+                     make_node(a_key, a_val, left -> right, right));
+  }
+
+  // if right heavy (balance is less than -1)
+  if(heightL - heightR < -1)
+  {
+    // if right-left heavy, double rotate
+    if(node_height(right -> left) > node_height(right -> right))
+    {
+      const NodePtr& rl = right -> left;
+      return make_node(rl -> key, rl -> value,
+                       make_node(a_key, a_val, left, rl -> left),
+                       make_node(right -> key, right -> value, rl -> right, right -> right));
+    }
+    return make_node(right -> key, right -> value,
+                     make_node(a_key, a_val, left, right -> left), right -> right);
+  }
+  return make_node(a_key, a_val, left, right);
+}
+
+
+// copies the search path down to the new leaf
+template<typename K, typename V, typename Compare>
+typename PersistentAVLCollection<K,V,Compare>::NodePtr
+PersistentAVLCollection<K,V,Compare>::add(const NodePtr& subtree_root, const K& a_key,
+                                          const V& a_val) const
+{
+  if(!subtree_root)
+    return make_node(a_key, a_val, nullptr, nullptr);
+  if(compare(a_key, subtree_root -> key) < 0)
+    return balance(subtree_root -> key, subtree_root -> value,
+                   add(subtree_root -> left, a_key, a_val), subtree_root -> right);
+  return balance(subtree_root -> key, subtree_root -> value,
+                 subtree_root -> left, add(subtree_root -> right, a_key, a_val));
+}
+
+
+// copies the search path only if the key is found
+template<typename K, typename V, typename Compare>
+typename PersistentAVLCollection<K,V,Compare>::NodePtr
+PersistentAVLCollection<K,V,Compare>::remove(const K& key, const NodePtr& subtree_root,
+                                             bool& removed) const
+{
+  if(!subtree_root)
+    return subtree_root;
+
+  auto order = compare(key, subtree_root -> key);
+  if(order < 0)
+  {
+    NodePtr left = remove(key, subtree_root -> left, removed);
+    if(!removed)
+      return subtree_root;
+    return balance(subtree_root -> key, subtree_root -> value, left, subtree_root -> right);
+  }
+  if(order > 0)
+  {
+    NodePtr right = remove(key, subtree_root -> right, removed);
+    if(!removed)
+      return subtree_root;
+    return balance(subtree_root -> key, subtree_root -> value, subtree_root -> left, right);
+  }
+
+  removed = true;
+  if(!subtree_root -> left)
+    return subtree_root -> right;
+  if(!subtree_root -> right)
+    return subtree_root -> left;
+
+  // two children: the inorder successor takes the node's place
+  NodePtr successor;
+  NodePtr rest = remove_min(subtree_root -> right, successor);
+  return balance(successor -> key, successor -> value, subtree_root -> left, rest);
+}
+
+
+template<typename K, typename V, typename Compare>
+typename PersistentAVLCollection<K,V,Compare>::NodePtr
+PersistentAVLCollection<K,V,Compare>::remove_min(const NodePtr& subtree_root, NodePtr& min_node)
+{
+  if(!subtree_root -> left)
+  {
+    min_node = subtree_root;
+    return subtree_root -> right;
+  }
+  NodePtr left = remove_min(subtree_root -> left, min_node);
+  return balance(subtree_root -> key, subtree_root -> value, left, subtree_root -> right);
+}
+
+
+// same middle-out construction as AVLCollection::build_sorted
+template<typename K, typename V, typename Compare>
+template<typename Iter>
+typename PersistentAVLCollection<K,V,Compare>::NodePtr
+PersistentAVLCollection<K,V,Compare>::build_sorted(Iter& next, int n)
+{
+  if(n == 0)
+    return nullptr;
+  NodePtr left = build_sorted(next, n / 2);
+  Iter mid = next;
+  ++next;
+  NodePtr right = build_sorted(next, n - n / 2 - 1);
+  return make_node(mid -> first, mid -> second, left, right);
+}
+
+
+template<typename K, typename V, typename Compare>
+void PersistentAVLCollection<K,V,Compare>::inorder(const Node* subtree_root, std::vector<K>& keys)
+{
+  if(subtree_root == nullptr)
+    return;
+  inorder(subtree_root -> left.get(), keys);
+  keys.push_back(subtree_root -> key);
+  inorder(subtree_root -> right.get(), keys);
+}
+
+
+template<typename K, typename V, typename Compare>
+template<typename Visitor>
+void PersistentAVLCollection<K,V,Compare>::range_search(const Node* subtree_root, const K& k1,
+                                                        const K& k2, Visitor& visit) const
+{
+  if(subtree_root == nullptr)
+    return;
+  auto low = compare(k1, subtree_root -> key);
+  auto high = compare(k2, subtree_root -> key);
+  if(low < 0)
+    range_search(subtree_root -> left.get(), k1, k2, visit);
+  if(low <= 0 && high >= 0)
+    visit(subtree_root -> key, subtree_root -> value);
+  if(high > 0)
+    range_search(subtree_root -> right.get(), k1, k2, visit);
+}
+
+
+#endif
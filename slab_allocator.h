@@ -0,0 +1,349 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   slab_allocator.h
+// Description:
+//            Node allocators for the AVL tree collection. The slab
+//            allocator carves nodes out of large contiguous blocks
+//            and recycles removed nodes through a free list, so the
+//            global heap is only touched once per block. The
+//            new/delete allocator goes to the heap for every node and
+//            is kept as a baseline for the performance tests.
+//
+//            Copies of a slab allocator share the same pool (any copy
+//            may free storage handed out by another), which is what
+//            lets trees trade nodes with each other. Copies of a
+//            new/delete allocator likewise share their counts, so a
+//            node freed by a copy is counted against the allocation.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+
+template<typename T>
+class SlabAllocator
+{
+public:
+
+  // create an allocator with a new, empty pool
+  SlabAllocator();
+
+  // return uninitialized storage for one object
+  T* allocate();
+
+  // give the storage of one object back to the pool's free list
+  void deallocate(T* ptr);
+
+  // free every block of the pool at once (objects are not
+  // destroyed); fails and returns false if the pool is shared
+  bool release();
+
+  // number of objects handed out over the life of the pool
+  long allocations() const;
+
+  // number of blocks requested from the global heap
+  long heap_allocations() const;
+
+  // number of bytes held by the pool's blocks
+  std::size_t heap_bytes() const;
+
+  // true if another allocator draws from the same pool
+  bool shared() const;
+
+  // allocators are equal if they draw from the same pool
+  bool operator==(const SlabAllocator<T>& rhs) const;
+  bool operator!=(const SlabAllocator<T>& rhs) const;
+
+private:
+
+  // an object slot, threaded onto the free list while unused
+  union Slot {
+    Slot* next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  // blocks and free list shared by all copies of an allocator
+  struct Pool {
+    std::vector<Slot*> blocks;
+    Slot* free_list;
+    Slot* next_slot;
+    Slot* block_end;
+    std::size_t block_size;
+    long allocs;
+    long heap_allocs;
+    std::size_t bytes;
+    ~Pool();
+  };
+
+  // smallest and largest number of slots in a block
+  static const std::size_t min_block = 32;
+  static const std::size_t max_block = 4096;
+
+  // grab a new block from the heap
+  void grow();
+
+  std::shared_ptr<Pool> pool;
+};
+
+
+template<typename T>
+class NewDeleteAllocator
+{
+public:
+
+  // return uninitialized storage for one object
+  T* allocate();
+
+  // give the storage of one object back to the heap
+  void deallocate(T* ptr);
+
+  // per-object storage cannot be dropped in bulk
+  bool release();
+
+  // number of objects handed out by this allocator
+  long allocations() const;
+
+  // every object is its own heap allocation
+  long heap_allocations() const;
+
+  // number of bytes held by live objects (not counting heap headers)
+  std::size_t heap_bytes() const;
+
+  // the heap can be used from any thread, so nothing is shared
+  bool shared() const;
+
+  // allocators are equal if they share counts (one is a copy of the
+  // other), so nodes only move between trees that count them together
+  bool operator==(const NewDeleteAllocator<T>& rhs) const;
+  bool operator!=(const NewDeleteAllocator<T>& rhs) const;
+
+private:
+
+  // counts shared by all copies of an allocator (atomic, since the
+  // copies may be used from different threads)
+  struct Counts {
+    std::atomic<long> allocs{0};
+    std::atomic<long> frees{0};
+  };
+
+  std::shared_ptr<Counts> counts = std::make_shared<Counts>();
+};
+
+
+//------------------------------------------------------------------------------
+// SlabAllocator
+//------------------------------------------------------------------------------
+
+
+// creates an allocator with an empty pool (no blocks yet)
+template<typename T>
+SlabAllocator<T>::SlabAllocator()
+  : pool(std::make_shared<Pool>())
+{
+  pool -> free_list = nullptr;
+  pool -> next_slot = nullptr;
+  pool -> block_end = nullptr;
+  pool -> block_size = min_block;
+  pool -> allocs = 0;
+  pool -> heap_allocs = 0;
+  pool -> bytes = 0;
+}
+
+
+// frees every block owned by the pool
+template<typename T>
+SlabAllocator<T>::Pool::~Pool()
+{
+  for(Slot* block : blocks)
+    ::operator delete(block);
+}
+
+
+// reuses a freed slot if possible, otherwise carves the next slot out
+// of the current block
+template<typename T>
+T* SlabAllocator<T>::allocate()
+{
+  Slot* slot = pool -> free_list;
+  if(slot != nullptr)
+    pool -> free_list = slot -> next;
+  else
+  {
+    if(pool -> next_slot == pool -> block_end)
+      grow();
+    slot = pool -> next_slot++;
+  }
+  pool -> allocs++;
+  return reinterpret_cast<T*>(slot -> storage);
+}
+
+
+// pushes the slot onto the free list
+template<typename T>
+void SlabAllocator<T>::deallocate(T* ptr)
+{
+  Slot* slot = reinterpret_cast<Slot*>(ptr);
+  slot -> next = pool -> free_list;
+  pool -> free_list = slot;
+}
+
+
+// drops all blocks at once if no other allocator uses the pool
+template<typename T>
+bool SlabAllocator<T>::release()
+{
+  if(pool.use_count() != 1)
+    return false;
+  for(Slot* block : pool -> blocks)
+    ::operator delete(block);
+  pool -> blocks.clear();
+  pool -> free_list = nullptr;
+  pool -> next_slot = nullptr;
+  pool -> block_end = nullptr;
+  pool -> block_size = min_block;
+  pool -> bytes = 0;
+  return true;
+}
+
+
+// returns the number of objects handed out
+template<typename T>
+long SlabAllocator<T>::allocations() const
+{
+  return pool -> allocs;
+}
+
+
+// returns the number of blocks taken from the heap
+template<typename T>
+long SlabAllocator<T>::heap_allocations() const
+{
+  return pool -> heap_allocs;
+}
+
+
+// returns the size of all blocks, used or not
+template<typename T>
+std::size_t SlabAllocator<T>::heap_bytes() const
+{
+  return pool -> bytes;
+}
+
+
+template<typename T>
+bool SlabAllocator<T>::shared() const
+{
+  return pool.use_count() != 1;
+}
+
+
+template<typename T>
+bool SlabAllocator<T>::operator==(const SlabAllocator<T>& rhs) const
+{
+  return pool == rhs.pool;
+}
+
+
+template<typename T>
+bool SlabAllocator<T>::operator!=(const SlabAllocator<T>& rhs) const
+{
+  return pool != rhs.pool;
+}
+
+
+// allocates a new block, doubling the block size each time up to
+// max_block slots
+template<typename T>
+void SlabAllocator<T>::grow()
+{
+  std::size_t n = pool -> block_size;
+  Slot* block = static_cast<Slot*>(::operator new(n * sizeof(Slot)));
+  pool -> blocks.push_back(block);
+  pool -> next_slot = block;
+  pool -> block_end = block + n;
+  pool -> heap_allocs++;
+  pool -> bytes += n * sizeof(Slot);
+  if(n < max_block)
+    pool -> block_size = n * 2;
+}
+
+
+//------------------------------------------------------------------------------
+// NewDeleteAllocator
+//------------------------------------------------------------------------------
+
+
+template<typename T>
+T* NewDeleteAllocator<T>::allocate()
+{
+  counts -> allocs.fetch_add(1, std::memory_order_relaxed);
+  return static_cast<T*>(::operator new(sizeof(T)));
+}
+
+
+template<typename T>
+void NewDeleteAllocator<T>::deallocate(T* ptr)
+{
+  counts -> frees.fetch_add(1, std::memory_order_relaxed);
+  ::operator delete(ptr);
+}
+
+
+template<typename T>
+bool NewDeleteAllocator<T>::release()
+{
+  return false;
+}
+
+
+template<typename T>
+long NewDeleteAllocator<T>::allocations() const
+{
+  return counts -> allocs.load(std::memory_order_relaxed);
+}
+
+
+template<typename T>
+long NewDeleteAllocator<T>::heap_allocations() const
+{
+  return allocations();
+}
+
+
+template<typename T>
+std::size_t NewDeleteAllocator<T>::heap_bytes() const
+{
+  return (allocations() - counts -> frees.load(std::memory_order_relaxed)) * sizeof(T);
+}
+
+
+template<typename T>
+bool NewDeleteAllocator<T>::shared() const
+{
+  return false;
+}
+
+
+template<typename T>
+bool NewDeleteAllocator<T>::operator==(const NewDeleteAllocator<T>& rhs) const
+{
+  return counts == rhs.counts;
+}
+
+
+template<typename T>
+bool NewDeleteAllocator<T>::operator!=(const NewDeleteAllocator<T>& rhs) const
+{
+  return counts != rhs.counts;
+}
+
+
+#endif
@@ -0,0 +1,216 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   std_collections.h
+// Description:
+//            Collection adapters over the standard library containers,
+//            used as baselines when benchmarking the trees:
+//            MapCollection wraps std::map (a red-black tree) and
+//            HashCollection wraps std::unordered_map. A hash table
+//            has no key order, so HashCollection answers range and
+//            sort by scanning every pair; it is meant to be measured
+//            on point operations (add, remove, find) only.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef STD_COLLECTIONS_H
+#define STD_COLLECTIONS_H
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include "collection.h"
+
+
+template<typename K, typename V, typename Less = std::less<K>>
+class MapCollection : public Collection<K,V>
+{
+public:
+
+  // add a new key-value pair into the collection
+  void add(const K& a_key, const V& a_val);
+
+  // remove a key-value pair from the collection
+  bool remove(const K& a_key);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+private:
+  std::map<K,V,Less> pairs;
+};
+
+
+template<typename K, typename V, typename Hash = std::hash<K>>
+class HashCollection : public Collection<K,V>
+{
+public:
+
+  // add a new key-value pair into the collection
+  void add(const K& a_key, const V& a_val);
+
+  // remove a key-value pair from the collection
+  bool remove(const K& a_key);
+
+  // find and return the value associated with the key
+  bool find(const K& search_key, V& the_val) const;
+
+  // find and return the values with keys >= to k1 and <= to k2 (a
+  // scan of the whole table)
+  void find(const K& k1, const K& k2, std::vector<V>& vals) const;
+
+  // return all of the keys in the collection
+  void keys(std::vector<K>& all_keys) const;
+
+  // return all of the keys in ascending (sorted) order
+  void sort(std::vector<K>& all_keys_sorted) const;
+
+  // return the number of key-value pairs in the collection
+  int size() const;
+
+private:
+  std::unordered_map<K,V,Hash> pairs;
+};
+
+
+//------------------------------------------------------------------------------
+// MapCollection
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V, typename Less>
+void MapCollection<K,V,Less>::add(const K& a_key, const V& a_val)
+{
+  pairs.emplace(a_key, a_val);
+}
+
+
+template<typename K, typename V, typename Less>
+bool MapCollection<K,V,Less>::remove(const K& a_key)
+{
+  return pairs.erase(a_key) > 0;
+}
+
+
+template<typename K, typename V, typename Less>
+bool MapCollection<K,V,Less>::find(const K& search_key, V& the_val) const
+{
+  auto found = pairs.find(search_key);
+  if(found == pairs.end())
+    return false;
+  the_val = found -> second;
+  return true;
+}
+
+
+// walks from the first key >= k1 while keys are <= k2
+template<typename K, typename V, typename Less>
+void MapCollection<K,V,Less>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  Less less;
+  for(auto cur = pairs.lower_bound(k1); cur != pairs.end() && !less(k2, cur -> first); ++cur)
+    vals.push_back(cur -> second);
+}
+
+
+template<typename K, typename V, typename Less>
+void MapCollection<K,V,Less>::keys(std::vector<K>& all_keys) const
+{
+  sort(all_keys);
+}
+
+
+template<typename K, typename V, typename Less>
+void MapCollection<K,V,Less>::sort(std::vector<K>& all_keys_sorted) const
+{
+  for(const auto& pair : pairs)
+    all_keys_sorted.push_back(pair.first);
+}
+
+
+template<typename K, typename V, typename Less>
+int MapCollection<K,V,Less>::size() const
+{
+  return pairs.size();
+}
+
+
+//------------------------------------------------------------------------------
+// HashCollection
+//------------------------------------------------------------------------------
+
+
+template<typename K, typename V, typename Hash>
+void HashCollection<K,V,Hash>::add(const K& a_key, const V& a_val)
+{
+  pairs.emplace(a_key, a_val);
+}
+
+
+template<typename K, typename V, typename Hash>
+bool HashCollection<K,V,Hash>::remove(const K& a_key)
+{
+  return pairs.erase(a_key) > 0;
+}
+
+
+template<typename K, typename V, typename Hash>
+bool HashCollection<K,V,Hash>::find(const K& search_key, V& the_val) const
+{
+  auto found = pairs.find(search_key);
+  if(found == pairs.end())
+    return false;
+  the_val = found -> second;
+  return true;
+}
+
+
+template<typename K, typename V, typename Hash>
+void HashCollection<K,V,Hash>::find(const K& k1, const K& k2, std::vector<V>& vals) const
+{
+  for(const auto& pair : pairs)
+    if(!(pair.first < k1) && !(k2 < pair.first))
+      vals.push_back(pair.second);
+}
+
+
+template<typename K, typename V, typename Hash>
+void HashCollection<K,V,Hash>::keys(std::vector<K>& all_keys) const
+{
+  for(const auto& pair : pairs)
+    all_keys.push_back(pair.first);
+}
+
+
+// copies the keys out, then sorts the copies
+template<typename K, typename V, typename Hash>
+void HashCollection<K,V,Hash>::sort(std::vector<K>& all_keys_sorted) const
+{
+  std::size_t first = all_keys_sorted.size();
+  keys(all_keys_sorted);
+  std::sort(all_keys_sorted.begin() + first, all_keys_sorted.end());
+}
+
+
+template<typename K, typename V, typename Hash>
+int HashCollection<K,V,Hash>::size() const
+{
+  return pairs.size();
+}
+
+
+#endif
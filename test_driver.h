@@ -35,19 +35,21 @@ private:
   // collection under test
   Collection<K,V>* test_collection;
   // test results for printing
-  int total_ins, ins_times;
-  int total_rem, rem_times;
-  int total_fnd, fnd_times;
-  int total_rng, rng_times;
-  int total_srt, srt_times;
+  // (times are kept in nanoseconds and printed in microseconds; see
+  // bench_harness.h for per-op latency distributions)
+  int total_ins; long ins_times;
+  int total_rem; long rem_times;
+  int total_fnd; long fnd_times;
+  int total_rng; long rng_times;
+  int total_srt; long srt_times;
   // helper functions to get timing results
-  int timed_add(std::fstream& in_file);
-  int timed_remove(std::fstream& in_file);
-  int timed_find(std::fstream& in_file);
-  int timed_range(std::fstream& in_file);
-  int timed_sort(std::fstream& in_file);
+  long timed_add(std::fstream& in_file);
+  long timed_remove(std::fstream& in_file);
+  long timed_find(std::fstream& in_file);
+  long timed_range(std::fstream& in_file);
+  long timed_sort(std::fstream& in_file);
   // print helper function
-  void print_one_result(std::string type, int total, int times) const;
+  void print_one_result(std::string type, int total, long times) const;
 };
 
 
@@ -64,7 +66,7 @@ void TestDriver<K,V>::run_tests()
   // open the file
   std::fstream in_file;
   in_file.open(filename);
-  // initialize data (all in microseconds)
+  // initialize data (all in nanoseconds)
   total_ins = 0, ins_times = 0;
   total_rem = 0, rem_times = 0;
   total_fnd = 0, fnd_times = 0;
@@ -101,15 +103,15 @@ void TestDriver<K,V>::run_tests()
 
 template<typename K, typename V>
 void TestDriver<K,V>::
-print_one_result(std::string type, int total, int times) const
+print_one_result(std::string type, int total, long times) const
 {
   using namespace std;
   if (total <= 0)
     return;
   cout << "  " << type << " Calls...: " << total << endl;
-  cout << "  " << type << " Time....: " << times
+  cout << "  " << type << " Time....: " << (times / 1000.0)
        << " microseconds" << endl;
-  cout << "  " << type << " Average.: " << ((1.0 * times) / total)
+  cout << "  " << type << " Average.: " << ((times / 1000.0) / total)
        << " microseconds" << endl << endl;
 }
 
@@ -129,7 +131,7 @@ void TestDriver<K,V>::print_results() const
 
 
 template<typename K, typename V>
-int TestDriver<K,V>::timed_add(std::fstream& in_file)
+long TestDriver<K,V>::timed_add(std::fstream& in_file)
 {
   using namespace std::chrono;
   K key;
@@ -139,14 +141,14 @@ int TestDriver<K,V>::timed_add(std::fstream& in_file)
   auto start = high_resolution_clock::now();
   test_collection->add(key, val);
   auto end = high_resolution_clock::now();
-  auto time = duration_cast<microseconds>(end - start);
-  int duration = time.count();
+  auto time = duration_cast<nanoseconds>(end - start);
+  long duration = time.count();
   return duration;
 }
 
 
 template<typename K, typename V>
-int TestDriver<K,V>::timed_remove(std::fstream& in_file)
+long TestDriver<K,V>::timed_remove(std::fstream& in_file)
 {
   using namespace std::chrono;
   K key;
@@ -154,13 +156,13 @@ int TestDriver<K,V>::timed_remove(std::fstream& in_file)
   auto start = high_resolution_clock::now();
   test_collection->remove(key);
   auto end = high_resolution_clock::now();
-  auto time = duration_cast<microseconds>(end - start);
-  int duration = time.count();
+  auto time = duration_cast<nanoseconds>(end - start);
+  long duration = time.count();
   return duration;
 }
 
 template<typename K, typename V>
-int TestDriver<K,V>::timed_find(std::fstream& in_file)
+long TestDriver<K,V>::timed_find(std::fstream& in_file)
 {
   using namespace std::chrono;
   K key;
@@ -169,13 +171,13 @@ int TestDriver<K,V>::timed_find(std::fstream& in_file)
   auto start = high_resolution_clock::now();
   test_collection->find(key, value);
   auto end = high_resolution_clock::now();
-  auto time = duration_cast<microseconds>(end - start);
-  int duration = time.count();
+  auto time = duration_cast<nanoseconds>(end - start);
+  long duration = time.count();
   return duration;
 }
 
 template<typename K, typename V>
-int TestDriver<K,V>::timed_range(std::fstream& in_file)
+long TestDriver<K,V>::timed_range(std::fstream& in_file)
 {
   using namespace std::chrono;
   K key1;
@@ -186,21 +188,21 @@ int TestDriver<K,V>::timed_range(std::fstream& in_file)
   auto start = high_resolution_clock::now();
   test_collection->find(key1, key2, vals);
   auto end = high_resolution_clock::now();
-  auto time = duration_cast<microseconds>(end - start);
-  int duration = time.count();
+  auto time = duration_cast<nanoseconds>(end - start);
+  long duration = time.count();
   return duration;
 }
 
 template<typename K, typename V>
-int TestDriver<K,V>::timed_sort(std::fstream& in_file)
+long TestDriver<K,V>::timed_sort(std::fstream& in_file)
 {
   using namespace std::chrono;
   std::vector<K> keys;
   auto start = high_resolution_clock::now();
   test_collection->sort(keys);
   auto end = high_resolution_clock::now();
-  auto time = duration_cast<microseconds>(end - start);
-  int duration = time.count();
+  auto time = duration_cast<nanoseconds>(end - start);
+  long duration = time.count();
   return duration;
 }
 
@@ -0,0 +1,407 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   trace_loader.h
+// Description:
+//            Pre-parsed workload traces. A Trace holds the operations
+//            of a trace file as a compact array (op type, key indices
+//            and value) plus every distinct key once, interned into a
+//            single character buffer, so replaying a trace does no
+//            parsing, i/o or string allocation.
+//
+//            Text traces (the add/remove/find/range/sort format read
+//            by TestDriver) are mapped with mmap and tokenized in
+//            place in one pass. A trace can be saved in a binary
+//            format (header, op array, key offsets, key characters,
+//            all at 8-byte aligned offsets) which is mapped and used
+//            as is on later runs, without parsing or copying. Like
+//            the collection images, the binary format uses the byte
+//            order of the machine that wrote it.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef TRACE_LOADER_H
+#define TRACE_LOADER_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <fstream>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// op types of a trace, in report order
+enum class TraceOpType : std::uint32_t { add, remove, find, range, sort };
+const int trace_op_types = 5;
+const char* const trace_op_names[trace_op_types] = {"add", "remove", "find", "range", "sort"};
+
+
+// one trace operation: keys are indices into the trace's interned
+// keys (key2 is the upper bound of a range), val is the added value
+struct TraceOp {
+  double val;
+  std::uint32_t key1;
+  std::uint32_t key2;
+  TraceOpType type;
+  std::uint32_t reserved;
+};
+
+
+// start of a binary trace
+struct TraceHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t header_size;
+  std::uint64_t op_count;
+  std::uint64_t key_count;
+  std::uint64_t ops_offset;
+  std::uint64_t offsets_offset;
+  std::uint64_t chars_offset;
+  std::uint64_t file_size;
+};
+
+
+// binary trace constants
+const char trace_magic[8] = {'A', 'V', 'L', 'T', 'R', 'A', 'C', 'E'};
+const std::uint32_t trace_version = 1;
+
+
+class Trace
+{
+public:
+
+  // create an empty trace
+  Trace();
+
+  // a mapping is owned by one trace
+  Trace(const Trace& rhs) = delete;
+  Trace& operator=(const Trace& rhs) = delete;
+
+  // unmap a binary trace
+  ~Trace();
+
+  // replace the contents with a text trace, returns false if the
+  // file can't be read
+  bool load_text(const std::string& filename);
+
+  // replace the contents with a mapped binary trace, returns false if
+  // the file isn't a valid binary trace
+  bool load_binary(const std::string& filename);
+
+  // load either format (binary traces are told apart by their magic)
+  bool load(const std::string& filename);
+
+  // write the trace in the binary format, returns false on an i/o
+  // error
+  bool save_binary(const std::string& filename) const;
+
+  // number of ops
+  std::size_t size() const;
+
+  // the ops in trace order
+  const TraceOp* begin() const;
+  const TraceOp* end() const;
+
+  // number of distinct keys
+  std::size_t key_count() const;
+
+  // the i-th interned key
+  std::string_view key(std::uint32_t i) const;
+
+private:
+
+  // next whitespace-separated token, false at the end of the text
+  static bool next_token(const char*& pos, const char* end, std::string_view& token);
+
+  // drop the contents (and any mapping)
+  void clear();
+
+  // storage of a text trace
+  std::vector<TraceOp> op_storage;
+  std::vector<std::uint64_t> offset_storage;
+  std::string char_storage;
+
+  // the ops and keys, pointing into the storage above or the mapping
+  const TraceOp* ops;
+  std::size_t op_count;
+  const std::uint64_t* key_offsets;
+  const char* key_chars;
+  std::size_t keys;
+
+  // mapped binary trace (nullptr if none)
+  void* mapping;
+  std::size_t mapping_size;
+};
+
+
+// constructs an empty trace
+inline Trace::Trace()
+  : ops(nullptr), op_count(0), key_offsets(nullptr), key_chars(nullptr), keys(0),
+    mapping(nullptr), mapping_size(0)
+{
+  offset_storage.push_back(0);
+  key_offsets = offset_storage.data();
+}
+
+
+inline Trace::~Trace()
+{
+  clear();
+}
+
+
+// maps the text and parses it in one pass: each key is looked up by a
+// view into the mapping and copied into the key buffer the first time
+// it is seen
+inline bool Trace::load_text(const std::string& filename)
+{
+  clear();
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat info;
+  if(::fstat(fd, &info) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  std::size_t text_size = info.st_size;
+  void* text = nullptr;
+  if(text_size > 0)
+    text = ::mmap(nullptr, text_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(text == MAP_FAILED)
+    return false;
+
+  // a text op line is at least a dozen characters long
+  std::unordered_map<std::string_view, std::uint32_t> interned;
+  interned.reserve(text_size / 12);
+  op_storage.reserve(text_size / 12);
+  auto intern = [&](std::string_view token) {
+    auto found = interned.try_emplace(token, std::uint32_t(interned.size()));
+    if(found.second)
+    {
+      char_storage.append(token);
+      offset_storage.push_back(char_storage.size());
+    }
+    return found.first -> second;
+  };
+
+  const char* pos = static_cast<const char*>(text);
+  const char* end = pos + text_size;
+  std::string_view op, key1, key2, val;
+  while(next_token(pos, end, op))
+  {
+    TraceOp next = {};
+    if(op == "add")
+    {
+      if(!next_token(pos, end, key1) || !next_token(pos, end, val))
+        break;
+      next.type = TraceOpType::add;
+      next.key1 = intern(key1);
+      std::from_chars(val.data(), val.data() + val.size(), next.val);
+    } else if(op == "remove" || op == "find")
+    {
+      if(!next_token(pos, end, key1))
+        break;
+      next.type = op == "remove" ? TraceOpType::remove : TraceOpType::find;
+      next.key1 = intern(key1);
+    } else if(op == "range")
+    {
+      if(!next_token(pos, end, key1) || !next_token(pos, end, key2))
+        break;
+      next.type = TraceOpType::range;
+      next.key1 = intern(key1);
+      next.key2 = intern(key2);
+    } else if(op == "sort")
+      next.type = TraceOpType::sort;
+    else
+      continue;
+    op_storage.push_back(next);
+  }
+  if(text != nullptr)
+    ::munmap(text, text_size);
+
+  ops = op_storage.data();
+  op_count = op_storage.size();
+  key_offsets = offset_storage.data();
+  key_chars = char_storage.data();
+  keys = interned.size();
+  return true;
+}
+
+
+// maps the file and checks the header, the section bounds and every
+// key index, then uses the sections in place
+inline bool Trace::load_binary(const std::string& filename)
+{
+  clear();
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  struct stat info;
+  if(::fstat(fd, &info) != 0 || std::size_t(info.st_size) < sizeof(TraceHeader))
+  {
+    ::close(fd);
+    return false;
+  }
+  void* addr = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(addr == MAP_FAILED)
+    return false;
+  const char* image = static_cast<const char*>(addr);
+  std::size_t size = info.st_size;
+
+  TraceHeader header;
+  std::memcpy(&header, image, sizeof(header));
+  bool ok = std::memcmp(header.magic, trace_magic, sizeof(header.magic)) == 0 &&
+    header.version == trace_version && header.header_size == sizeof(TraceHeader) &&
+    header.file_size == size && header.key_count < (std::uint64_t(1) << 32) &&
+    header.ops_offset % 8 == 0 && header.ops_offset <= size &&
+    header.op_count <= (size - header.ops_offset) / sizeof(TraceOp) &&
+    header.offsets_offset % 8 == 0 && header.offsets_offset <= size &&
+    header.key_count < (size - header.offsets_offset) / sizeof(std::uint64_t) &&
+    header.chars_offset <= size;
+  if(ok)
+  {
+    const std::uint64_t* offsets = reinterpret_cast<const std::uint64_t*>(image + header.offsets_offset);
+    const TraceOp* first = reinterpret_cast<const TraceOp*>(image + header.ops_offset);
+    ok = offsets[0] == 0 && offsets[header.key_count] <= size - header.chars_offset;
+    for(std::size_t i = 0; ok && i < header.op_count; ++i)
+      ok = first[i].key1 < header.key_count + (first[i].type == TraceOpType::sort) &&
+        (first[i].type != TraceOpType::range || first[i].key2 < header.key_count) &&
+        std::uint32_t(first[i].type) < trace_op_types;
+  }
+  if(!ok)
+  {
+    ::munmap(addr, size);
+    return false;
+  }
+
+  mapping = addr;
+  mapping_size = size;
+  ops = reinterpret_cast<const TraceOp*>(image + header.ops_offset);
+  op_count = header.op_count;
+  key_offsets = reinterpret_cast<const std::uint64_t*>(image + header.offsets_offset);
+  key_chars = image + header.chars_offset;
+  keys = header.key_count;
+  return true;
+}
+
+
+inline bool Trace::load(const std::string& filename)
+{
+  char magic[sizeof(trace_magic)] = {};
+  std::ifstream in_file(filename, std::ios::binary);
+  in_file.read(magic, sizeof(magic));
+  in_file.close();
+  if(std::memcmp(magic, trace_magic, sizeof(magic)) == 0)
+    return load_binary(filename);
+  return load_text(filename);
+}
+
+
+// writes the header, then each section padded to 8 bytes
+inline bool Trace::save_binary(const std::string& filename) const
+{
+  auto align = [](std::string& image) { image.resize((image.size() + 7) / 8 * 8, '\0'); };
+  TraceHeader header = {};
+  std::memcpy(header.magic, trace_magic, sizeof(header.magic));
+  header.version = trace_version;
+  header.header_size = sizeof(TraceHeader);
+  header.op_count = op_count;
+  header.key_count = keys;
+  std::string image(sizeof(TraceHeader), '\0');
+  align(image);
+  header.ops_offset = image.size();
+  image.append(reinterpret_cast<const char*>(ops), op_count * sizeof(TraceOp));
+  align(image);
+  header.offsets_offset = image.size();
+  image.append(reinterpret_cast<const char*>(key_offsets), (keys + 1) * sizeof(std::uint64_t));
+  header.chars_offset = image.size();
+  image.append(key_chars, key_offsets[keys]);
+  align(image);
+  header.file_size = image.size();
+  std::memcpy(image.data(), &header, sizeof(header));
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write(image.data(), image.size());
+  return bool(out.flush());
+}
+
+
+inline std::size_t Trace::size() const
+{
+  return op_count;
+}
+
+
+inline const TraceOp* Trace::begin() const
+{
+  return ops;
+}
+
+
+inline const TraceOp* Trace::end() const
+{
+  return ops + op_count;
+}
+
+
+inline std::size_t Trace::key_count() const
+{
+  return keys;
+}
+
+
+inline std::string_view Trace::key(std::uint32_t i) const
+{
+  return std::string_view(key_chars + key_offsets[i], key_offsets[i + 1] - key_offsets[i]);
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+inline bool Trace::next_token(const char*& pos, const char* end, std::string_view& token)
+{
+  while(pos != end && (*pos == ' ' || *pos == '\n' || *pos == '\t' || *pos == '\r'))
+    ++pos;
+  if(pos == end)
+    return false;
+  const char* start = pos;
+  while(pos != end && *pos != ' ' && *pos != '\n' && *pos != '\t' && *pos != '\r')
+    ++pos;
+  token = std::string_view(start, pos - start);
+  return true;
+}
+
+
+inline void Trace::clear()
+{
+  if(mapping != nullptr)
+    ::munmap(mapping, mapping_size);
+  mapping = nullptr;
+  mapping_size = 0;
+  op_storage.clear();
+  offset_storage.assign(1, 0);
+  char_storage.clear();
+  ops = nullptr;
+  op_count = 0;
+  key_offsets = offset_storage.data();
+  key_chars = char_storage.data();
+  keys = 0;
+}
+
+
+#endif
@@ -0,0 +1,107 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   workload_gen.cpp
+// Description:
+//            Writes a synthetic workload trace (see
+//            workload_generator.h) as text, which TestDriver and
+//            avlPerf can replay, or in the binary trace format read
+//            by avlBench.
+//
+//            usage: avlGen file [--workload a|b|c|d|e] [--records N]
+//                   [--ops N] [--find W] [--update W] [--insert W]
+//                   [--remove W] [--range W] [--sort W]
+//                   [--dist uniform|zipfian|sequential|hotspot|latest]
+//                   [--theta T] [--hot-fraction F] [--hot-ops F]
+//                   [--key-length L] [--range-width N] [--seed S]
+//                   [--no-load] [--binary]
+//
+//----------------------------------------------------------------------
+
+#include <iostream>
+#include <string>
+#include "workload_generator.h"
+
+using namespace std;
+
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    cout << "usage: " << argv[0] << " file [--workload a-e] [--records N] [--ops N]"
+         << " [--find|--update|--insert|--remove|--range|--sort W] [--dist NAME]"
+         << " [--theta T] [--hot-fraction F] [--hot-ops F] [--key-length L]"
+         << " [--range-width N] [--seed S] [--no-load] [--binary]" << endl;
+    return 1;
+  }
+  WorkloadOptions options;
+  bool binary = false;
+  for (int i = 2; i < argc; ++i) {
+    string arg = argv[i];
+    bool has_value = i + 1 < argc;
+    if (arg == "--no-load")
+      options.load = false;
+    else if (arg == "--binary")
+      binary = true;
+    else if (!has_value) {
+      cerr << "missing value for " << arg << endl;
+      return 1;
+    }
+    else if (arg == "--workload") {
+      if (!workload_preset(argv[++i], options)) {
+        cerr << "unknown workload: " << argv[i] << endl;
+        return 1;
+      }
+    }
+    else if (arg == "--dist") {
+      if (!key_distribution(argv[++i], options.distribution)) {
+        cerr << "unknown distribution: " << argv[i] << endl;
+        return 1;
+      }
+    }
+    else if (arg == "--records")
+      options.records = stol(argv[++i]);
+    else if (arg == "--ops")
+      options.operations = stol(argv[++i]);
+    else if (arg == "--find")
+      options.find_ratio = stod(argv[++i]);
+    else if (arg == "--update")
+      options.update_ratio = stod(argv[++i]);
+    else if (arg == "--insert")
+      options.insert_ratio = stod(argv[++i]);
+    else if (arg == "--remove")
+      options.remove_ratio = stod(argv[++i]);
+    else if (arg == "--range")
+      options.range_ratio = stod(argv[++i]);
+    else if (arg == "--sort")
+      options.sort_ratio = stod(argv[++i]);
+    else if (arg == "--theta")
+      options.zipf_theta = stod(argv[++i]);
+    else if (arg == "--hot-fraction")
+      options.hot_fraction = stod(argv[++i]);
+    else if (arg == "--hot-ops")
+      options.hot_ops = stod(argv[++i]);
+    else if (arg == "--key-length")
+      options.key_length = stoi(argv[++i]);
+    else if (arg == "--range-width")
+      options.range_width = stol(argv[++i]);
+    else if (arg == "--seed")
+      options.seed = stoull(argv[++i]);
+    else {
+      cerr << "unknown option: " << arg << endl;
+      return 1;
+    }
+  }
+
+  WorkloadGenerator generator(options);
+  if (!generator.valid()) {
+    cerr << "keys of " << options.key_length << " letters can't hold "
+         << options.records + options.operations << " records (or theta isn't in (0, 1))" << endl;
+    return 1;
+  }
+  bool ok = binary ? generator.write_binary(argv[1]) : generator.write_text(argv[1]);
+  if (!ok) {
+    cerr << "cannot write " << argv[1] << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,472 @@
+//----------------------------------------------------------------------
+// Author: Makoto Kewish
+// File:   workload_generator.h
+// Description:
+//            Synthetic workload traces in the add/remove/find/range/
+//            sort format (text, or binary as read by trace_loader.h).
+//            A trace has a load phase that adds every record, then a
+//            run phase of operations drawn at configurable ratios:
+//            finds, updates (a remove and an add of the same key, so
+//            keys stay unique), inserts of new records, removes of the
+//            oldest record, ranges and sorts. The record an operation
+//            touches is picked by a key distribution: uniform,
+//            zipfian, sequential, hotspot or latest (zipfian over the
+//            newest records). Presets follow the YCSB core workloads.
+//
+//            Record r's key is a fixed-length string of capital
+//            letters: r scrambled by a bijection of [0, 26^L), so keys
+//            are unique and inserts land all over the key space. A
+//            range covers range_width records on average.
+//
+//----------------------------------------------------------------------
+
+
+#ifndef WORKLOAD_GENERATOR_H
+#define WORKLOAD_GENERATOR_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <random>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include "trace_loader.h"
+
+
+// how the record of each operation is picked
+enum class KeyDistribution { uniform, zipfian, sequential, hotspot, latest };
+
+
+// workload knobs (ratios are relative weights of the run phase ops)
+struct WorkloadOptions {
+  // records added by the load phase
+  long records = 100000;
+
+  // operations in the run phase
+  long operations = 100000;
+
+  // include the load phase in the trace
+  bool load = true;
+
+  double find_ratio = 0.5;
+  double update_ratio = 0.5;
+  double insert_ratio = 0;
+  double remove_ratio = 0;
+  double range_ratio = 0;
+  double sort_ratio = 0;
+
+  KeyDistribution distribution = KeyDistribution::zipfian;
+
+  // zipfian skew (YCSB uses 0.99)
+  double zipf_theta = 0.99;
+
+  // hotspot: hot_ops of the operations go to hot_fraction of the records
+  double hot_fraction = 0.2;
+  double hot_ops = 0.8;
+
+  // characters per key
+  int key_length = 10;
+
+  // average number of records a range covers
+  long range_width = 100;
+
+  std::uint64_t seed = 1;
+};
+
+
+// set the ratios and distribution of YCSB core workload a-e; false if
+// the name isn't one of them
+bool workload_preset(const std::string& name, WorkloadOptions& options);
+
+
+// read a distribution name, false if it isn't one
+bool key_distribution(const std::string& name, KeyDistribution& distribution);
+
+
+// a key as handed to a sink: its scrambled code, and its record
+// number (or -1 for a range bound that isn't a record)
+struct WorkloadKey {
+  std::uint64_t code;
+  long record;
+};
+
+
+class WorkloadGenerator
+{
+public:
+
+  // prepare a generator (check valid before generating)
+  WorkloadGenerator(const WorkloadOptions& options);
+
+  // true if the keys are long enough for every record
+  bool valid() const;
+
+  // call sink(type, key1, key2, val) for every operation (key2 is only
+  // meaningful for ranges)
+  template<typename Sink>
+  void generate(Sink sink) const;
+
+  // the key with a given code
+  std::string key(std::uint64_t code) const;
+
+  // code of record r
+  std::uint64_t record_code(long r) const;
+
+  // write the trace as text or in the binary trace format, returns
+  // false on an i/o error
+  bool write_text(const std::string& filename) const;
+  bool write_binary(const std::string& filename) const;
+
+private:
+
+  // letters that are scrambled (the rest of a long key is padding)
+  static const int code_letters = 13;
+
+  // zipfian rank in [0, zipf_items) (Gray et al., as in YCSB)
+  long zipfian(std::mt19937_64& rng) const;
+
+  WorkloadOptions options;
+
+  // size of the scrambled code space, 26^min(key_length, 13)
+  std::uint64_t code_space;
+
+  // zipfian constants over zipf_items ranks
+  long zipf_items;
+  double zeta_n;
+  double zeta_2;
+  double alpha;
+  double eta;
+};
+
+
+//------------------------------------------------------------------------------
+// Options
+//------------------------------------------------------------------------------
+
+
+// a: update heavy, b: read mostly, c: read only, d: read latest,
+// e: short ranges
+inline bool workload_preset(const std::string& name, WorkloadOptions& options)
+{
+  options.find_ratio = options.update_ratio = options.insert_ratio = 0;
+  options.remove_ratio = options.range_ratio = options.sort_ratio = 0;
+  options.distribution = KeyDistribution::zipfian;
+  if(name == "a")
+    options.find_ratio = options.update_ratio = 0.5;
+  else if(name == "b")
+  {
+    options.find_ratio = 0.95;
+    options.update_ratio = 0.05;
+  } else if(name == "c")
+    options.find_ratio = 1;
+  else if(name == "d")
+  {
+    options.find_ratio = 0.95;
+    options.insert_ratio = 0.05;
+    options.distribution = KeyDistribution::latest;
+  } else if(name == "e")
+  {
+    options.range_ratio = 0.95;
+    options.insert_ratio = 0.05;
+    options.range_width = 50;
+  } else
+    return false;
+  return true;
+}
+
+
+inline bool key_distribution(const std::string& name, KeyDistribution& distribution)
+{
+  const char* names[] = {"uniform", "zipfian", "sequential", "hotspot", "latest"};
+  for(int i = 0; i < 5; ++i)
+    if(name == names[i])
+    {
+      distribution = KeyDistribution(i);
+      return true;
+    }
+  return false;
+}
+
+
+//------------------------------------------------------------------------------
+// WorkloadGenerator
+//------------------------------------------------------------------------------
+
+
+// the zipfian constants need zeta(n), a sum over all n ranks, so they
+// are computed once here
+inline WorkloadGenerator::WorkloadGenerator(const WorkloadOptions& options)
+  : options(options), code_space(1)
+{
+  for(int i = 0; i < std::min(options.key_length, code_letters); ++i)
+    code_space *= 26;
+
+  zipf_items = std::max(options.records, 1L);
+  double theta = options.zipf_theta;
+  zeta_n = 0;
+  for(long i = 1; i <= zipf_items; ++i)
+    zeta_n += 1 / std::pow(double(i), theta);
+  zeta_2 = 1 + 1 / std::pow(2.0, theta);
+  alpha = 1 / (1 - theta);
+  eta = (1 - std::pow(2.0 / zipf_items, 1 - theta)) / (1 - zeta_2 / zeta_n);
+}
+
+
+// every insert makes a new record, so at most records + operations
+// codes are needed
+inline bool WorkloadGenerator::valid() const
+{
+  return options.key_length > 0 && options.records >= 0 && options.operations >= 0 &&
+    std::uint64_t(options.records + options.operations) <= code_space &&
+    options.zipf_theta > 0 && options.zipf_theta < 1;
+}
+
+
+// the load phase adds records 0 .. records-1; the run phase keeps the
+// live records in [low, high), removing from low and inserting at high
+template<typename Sink>
+void WorkloadGenerator::generate(Sink sink) const
+{
+  std::mt19937_64 rng(options.seed);
+  std::uniform_real_distribution<double> unit(0, 1);
+  auto value = [&] { return std::round(unit(rng) * 2000) / 100; };
+  auto record_key = [this](long r) { return WorkloadKey{record_code(r), r}; };
+
+  long low = 0;
+  long high = options.records;
+  if(options.load)
+    for(long r = 0; r < high; ++r)
+      sink(TraceOpType::add, record_key(r), record_key(r), value());
+
+  double weights[] = {options.find_ratio, options.update_ratio, options.insert_ratio,
+                      options.remove_ratio, options.range_ratio, options.sort_ratio};
+  std::discrete_distribution<int> pick_op(std::begin(weights), std::end(weights));
+  long cursor = 0;
+
+  // a live record picked by the distribution; ranks are scrambled
+  // (except by latest) so popular records aren't neighbours
+  auto pick = [&]() -> long {
+    long live = high - low;
+    std::uint64_t rank = 0;
+    switch(options.distribution)
+    {
+    case KeyDistribution::uniform:
+      return low + long(rng() % live);
+    case KeyDistribution::zipfian:
+      rank = zipfian(rng);
+      break;
+    case KeyDistribution::sequential:
+      return low + cursor++ % live;
+    case KeyDistribution::hotspot:
+    {
+      long hot = std::max(1L, long(live * options.hot_fraction));
+      if(unit(rng) < options.hot_ops || hot == live)
+        rank = rng() % hot;
+      else
+        rank = hot + rng() % (live - hot);
+      break;
+    }
+    case KeyDistribution::latest:
+      return high - 1 - zipfian(rng) % live;
+    }
+    return low + long((rank * 0x9E3779B97F4A7C15ull >> 17) % live);
+  };
+
+  double span = double(code_space) / std::max(options.records, 1L) * options.range_width;
+  std::uint64_t range_span = span >= double(code_space) ? code_space : std::max<std::uint64_t>(1, span);
+  for(long i = 0; i < options.operations; ++i)
+  {
+    int op = pick_op(rng);
+    // nothing to find, update, remove or scan without live records
+    if(high == low && op != 2 && op != 5)
+      op = 2;
+    switch(op)
+    {
+    case 0:
+    {
+      WorkloadKey key = record_key(pick());
+      sink(TraceOpType::find, key, key, 0.0);
+      break;
+    }
+    case 1:
+    {
+      WorkloadKey key = record_key(pick());
+      sink(TraceOpType::remove, key, key, 0.0);
+      sink(TraceOpType::add, key, key, value());
+      break;
+    }
+    case 2:
+      sink(TraceOpType::add, record_key(high), record_key(high), value());
+      high++;
+      break;
+    case 3:
+      sink(TraceOpType::remove, record_key(low), record_key(low), 0.0);
+      low++;
+      break;
+    case 4:
+    {
+      WorkloadKey first = record_key(pick());
+      std::uint64_t last = std::min(code_space - 1, first.code + range_span);
+      sink(TraceOpType::range, first, WorkloadKey{last, -1}, 0.0);
+      break;
+    }
+    case 5:
+      sink(TraceOpType::sort, WorkloadKey{0, -1}, WorkloadKey{0, -1}, 0.0);
+      break;
+    }
+  }
+}
+
+
+// the code in base 26 with 'A' as zero, padded on the left with 'A'
+inline std::string WorkloadGenerator::key(std::uint64_t code) const
+{
+  std::string chars(options.key_length, 'A');
+  for(int i = options.key_length - 1; i >= 0 && code > 0; --i)
+  {
+    chars[i] = char('A' + code % 26);
+    code /= 26;
+  }
+  return chars;
+}
+
+
+// multiplying by a number coprime to 26 is a bijection of [0, 26^L)
+inline std::uint64_t WorkloadGenerator::record_code(long r) const
+{
+  unsigned __int128 code = (unsigned __int128)(std::uint64_t(r)) * 2654435761u + 12345;
+  return std::uint64_t(code % code_space);
+}
+
+
+// one line per op, written through a large buffer
+inline bool WorkloadGenerator::write_text(const std::string& filename) const
+{
+  std::ofstream out(filename, std::ios::trunc);
+  if(!out)
+    return false;
+  std::string buffer;
+  char val[32];
+  generate([&](TraceOpType type, const WorkloadKey& key1, const WorkloadKey& key2, double v) {
+    buffer += trace_op_names[int(type)];
+    if(type != TraceOpType::sort)
+      buffer += ' ' + key(key1.code);
+    if(type == TraceOpType::range)
+      buffer += ' ' + key(key2.code);
+    if(type == TraceOpType::add)
+    {
+      std::snprintf(val, sizeof(val), " %.2f", v);
+      buffer += val;
+    }
+    buffer += '\n';
+    if(buffer.size() > (1 << 20))
+    {
+      out.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  });
+  out.write(buffer.data(), buffer.size());
+  return bool(out.flush());
+}
+
+
+// streams the ops straight to the file: record r's key index is r, and
+// range bounds are numbered after the last record, so a first pass
+// only counts the records. the keys follow the ops, and the header is
+// written last
+inline bool WorkloadGenerator::write_binary(const std::string& filename) const
+{
+  long record_count = options.records;
+  generate([&](TraceOpType type, const WorkloadKey& key1, const WorkloadKey& key2, double v) {
+    if(key1.record >= record_count)
+      record_count = key1.record + 1;
+  });
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if(!out)
+    return false;
+  TraceHeader header = {};
+  std::memcpy(header.magic, trace_magic, sizeof(header.magic));
+  header.version = trace_version;
+  header.header_size = sizeof(TraceHeader);
+  header.ops_offset = (sizeof(TraceHeader) + 7) / 8 * 8;
+  out.write(std::string(header.ops_offset, '\0').data(), header.ops_offset);
+
+  std::vector<std::uint64_t> bounds;
+  std::vector<TraceOp> buffer;
+  auto flush = [&] {
+    out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(TraceOp));
+    buffer.clear();
+  };
+  generate([&](TraceOpType type, const WorkloadKey& key1, const WorkloadKey& key2, double v) {
+    TraceOp op = {};
+    op.type = type;
+    op.val = v;
+    if(type != TraceOpType::sort)
+      op.key1 = key1.record;
+    if(type == TraceOpType::range)
+    {
+      op.key2 = record_count + bounds.size();
+      bounds.push_back(key2.code);
+    }
+    buffer.push_back(op);
+    header.op_count++;
+    if(buffer.size() == 65536)
+      flush();
+  });
+  flush();
+
+  // every key has key_length characters
+  header.key_count = record_count + bounds.size();
+  header.offsets_offset = header.ops_offset + header.op_count * sizeof(TraceOp);
+  std::vector<std::uint64_t> offsets;
+  for(std::uint64_t i = 0; i <= header.key_count; ++i)
+  {
+    offsets.push_back(i * options.key_length);
+    if(offsets.size() == 65536 || i == header.key_count)
+    {
+      out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(std::uint64_t));
+      offsets.clear();
+    }
+  }
+  header.chars_offset = header.offsets_offset + (header.key_count + 1) * sizeof(std::uint64_t);
+  std::string chars;
+  for(std::uint64_t i = 0; i < header.key_count; ++i)
+  {
+    chars += key(i < std::uint64_t(record_count) ? record_code(i) : bounds[i - record_count]);
+    if(chars.size() > (1 << 20) || i + 1 == header.key_count)
+    {
+      out.write(chars.data(), chars.size());
+      chars.clear();
+    }
+  }
+  std::uint64_t end = header.chars_offset + header.key_count * options.key_length;
+  header.file_size = (end + 7) / 8 * 8;
+  out.write(std::string(header.file_size - end, '\0').data(), header.file_size - end);
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  return bool(out.flush());
+}
+
+
+//------------------------------------------------------------------------------
+// Helper Functions
+//------------------------------------------------------------------------------
+
+
+inline long WorkloadGenerator::zipfian(std::mt19937_64& rng) const
+{
+  double u = std::uniform_real_distribution<double>(0, 1)(rng);
+  double uz = u * zeta_n;
+  if(uz < 1)
+    return 0;
+  if(uz < zeta_2)
+    return 1;
+  long rank = long(zipf_items * std::pow(eta * u - eta + 1, alpha));
+  return std::min(rank, zipf_items - 1);
+}
+
+
+#endif